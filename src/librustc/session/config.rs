@@ -46,7 +46,7 @@ use std::hash::Hasher;
 use std::collections::hash_map::DefaultHasher;
 use std::collections::HashSet;
 use std::iter::FromIterator;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
 
 pub struct Config {
     pub target: Target,
@@ -1098,8 +1098,46 @@ options! {DebuggingOptions, DebuggingSetter, basic_debugging_options,
                  "run the non-lexical lifetimes MIR pass"),
     trans_time_graph: bool = (false, parse_bool, [UNTRACKED],
         "generate a graphical HTML report of time spent in trans and LLVM"),
+    trans_trace: bool = (false, parse_bool, [UNTRACKED],
+        "generate a Chrome trace-event file of time spent in trans and LLVM passes"),
     thinlto: bool = (false, parse_bool, [TRACKED],
         "enable ThinLTO when possible"),
+    thinlto_preserve_roots_only: bool = (false, parse_bool, [TRACKED],
+        "only preserve exported symbols during ThinLTO, not everything they reference"),
+    thinlto_emit_index: bool = (false, parse_bool, [UNTRACKED],
+        "run each ThinLTO backend in a separate rustc process, from a per-module index \
+         shard written to disk"),
+    thinlto_backend_job: Option<String> = (None, parse_opt_string, [UNTRACKED],
+        "instead of compiling, run the ThinLTO backend job described by this file \
+         (used internally by -Z thinlto-emit-index)"),
+    thinlto_report: bool = (false, parse_bool, [UNTRACKED],
+        "write a JSON report of ThinLTO import decisions and per-module timings"),
+    thinlto_cache_dir: Option<String> = (None, parse_opt_string, [UNTRACKED],
+        "cache optimized ThinLTO objects in this directory and reuse them across builds"),
+    schedule_by_llvm_cost: bool = (false, parse_bool, [UNTRACKED],
+        "estimate the cost of LLVM work items from their IR and start the costliest first"),
+    llvm_pass_timings: bool = (false, parse_bool, [UNTRACKED],
+        "write the time spent in each LLVM pass to a JSON file per codegen unit"),
+    new_llvm_pass_manager: bool = (false, parse_bool, [TRACKED],
+        "use LLVM's new pass manager to run the default optimization pipeline"),
+    objects_in_memory: bool = (false, parse_bool, [UNTRACKED],
+        "keep object files in memory when they're only going into an archive"),
+    assemble_emitted_asm: bool = (false, parse_bool, [TRACKED],
+        "when emitting both assembly and objects, codegen once and assemble the \
+         assembly into the object with the target's own assembler"),
+    pgo_gen: Option<String> = (None, parse_opt_string, [TRACKED],
+        "instrument the code to generate PGO profile data into the given file \
+         (or LLVM's default location if the file name is empty), only takes effect \
+         with optimizations enabled"),
+    pgo_use: String = (String::new(), parse_string, [TRACKED],
+        "optimize using the PGO profile data in the given .profdata file"),
+    merge_functions: bool = (false, parse_bool, [TRACKED],
+        "fold functions with identical code into one when optimizing"),
+    embed_bitcode: bool = (false, parse_bool, [TRACKED],
+        "embed the LLVM bitcode of each object file in a section of it"),
+    reuse_unchanged_ir_objects: bool = (false, parse_bool, [UNTRACKED],
+        "when compiling incrementally, reuse the previous object file of a codegen unit \
+         if its unoptimized LLVM IR didn't change"),
     inline_in_all_cgus: Option<bool> = (None, parse_opt_bool, [TRACKED],
         "control whether #[inline] functions are in all cgus"),
 }
@@ -1553,6 +1591,15 @@ pub fn build_session_options_and_crate_config(matches: &getopts::Matches)
         early_error(error_format, "can't perform LTO when compiling incrementally");
     }
 
+    if debugging_opts.pgo_gen.is_some() && !debugging_opts.pgo_use.is_empty() {
+        early_error(error_format, "options `-Z pgo-gen` and `-Z pgo-use` are exclusive");
+    }
+
+    if !debugging_opts.pgo_use.is_empty() && !Path::new(&debugging_opts.pgo_use).exists() {
+        early_error(error_format, &format!("profile data file `{}` passed to `-Z pgo-use` \
+                                            does not exist", debugging_opts.pgo_use));
+    }
+
     let mut prints = Vec::<PrintRequest>::new();
     if cg.target_cpu.as_ref().map_or(false, |s| s == "help") {
         prints.push(PrintRequest::TargetCPUs);
@@ -2650,6 +2697,14 @@ mod tests {
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
         opts.debugging_opts.dump_mir_dir = Some(String::from("abc"));
         assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.thinlto_cache_dir = Some(String::from("abc"));
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.thinlto_emit_index = true;
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.thinlto_backend_job = Some(String::from("abc"));
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
+        opts.debugging_opts.reuse_unchanged_ir_objects = true;
+        assert_eq!(reference.dep_tracking_hash(), opts.dep_tracking_hash());
 
         // Make sure changing a [TRACKED] option changes the hash
         opts = reference.clone();
@@ -2699,5 +2754,33 @@ mod tests {
         opts = reference.clone();
         opts.debugging_opts.relro_level = Some(RelroLevel::Full);
         assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.thinlto_preserve_roots_only = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.new_llvm_pass_manager = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.assemble_emitted_asm = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.pgo_gen = Some(String::from("default.profraw"));
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.pgo_use = String::from("default.profdata");
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.merge_functions = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
+
+        opts = reference.clone();
+        opts.debugging_opts.embed_bitcode = true;
+        assert!(reference.dep_tracking_hash() != opts.dep_tracking_hash());
     }
 }
@@ -87,7 +87,7 @@ use std::env;
 use std::ffi::OsString;
 use std::io::{self, Read, Write};
 use std::iter::repeat;
-use std::path::PathBuf;
+use std::path::{Path, PathBuf};
 use std::process::{self, Command, Stdio};
 use std::rc::Rc;
 use std::str;
@@ -158,6 +158,7 @@ pub use rustc_trans::LlvmTransCrate as DefaultTransCrate;
 
 #[cfg(not(feature="llvm"))]
 mod rustc_trans {
+    use std::path::Path;
     use syntax_pos::symbol::Symbol;
     use rustc::session::Session;
     use rustc::session::config::PrintRequest;
@@ -170,6 +171,7 @@ mod rustc_trans {
     pub fn print_passes() {}
     pub fn print(_req: PrintRequest, _sess: &Session) {}
     pub fn target_features(_sess: &Session) -> Vec<Symbol> { vec![] }
+    pub fn run_thinlto_backend_job(_sess: &Session, _path: &Path) {}
 
     pub mod back {
         pub mod write {
@@ -544,6 +546,11 @@ impl<'a> CompilerCalls<'a> for RustcDefaultCalls {
                      odir: &Option<PathBuf>,
                      ofile: &Option<PathBuf>)
                      -> Compilation {
+        if let Some(ref job) = sess.opts.debugging_opts.thinlto_backend_job {
+            rustc_trans::run_thinlto_backend_job(sess, Path::new(job));
+            return Compilation::Stop;
+        }
+
         RustcDefaultCalls::print_crate_info(sess, Some(input), odir, ofile)
             .and_then(|| RustcDefaultCalls::list_metadata(sess, cstore, matches, input))
     }
@@ -131,6 +131,18 @@ pub enum Attribute {
     SanitizeThread  = 20,
     SanitizeAddress = 21,
     SanitizeMemory  = 22,
+    Dereferenceable = 23,
+}
+
+/// Matches LLVMRustAttributeEntry in RustWrapper.cpp
+#[repr(C)]
+#[derive(Copy, Clone, Debug)]
+pub struct AttributeEntry {
+    pub index: c_uint,
+    pub kind: Attribute,
+    /// The value of attributes that carry one, like the number of bytes for
+    /// `Dereferenceable`, or 0.
+    pub value: u64,
 }
 
 /// LLVMIntPredicate
@@ -281,6 +293,18 @@ pub enum CodeGenOptLevel {
     Aggressive,
 }
 
+/// LLVMRustPassBuilderOptLevel
+#[derive(Copy, Clone, PartialEq)]
+#[repr(C)]
+pub enum PassBuilderOptLevel {
+    O0,
+    O1,
+    O2,
+    O3,
+    Os,
+    Oz,
+}
+
 /// LLVMRelocMode
 #[derive(Copy, Clone, PartialEq)]
 #[repr(C)]
@@ -351,6 +375,44 @@ pub enum ThinLTOData {}
 /// LLVMRustThinLTOBuffer
 pub enum ThinLTOBuffer {}
 
+/// LLVMRustThinLTOAnalysis
+pub enum ThinLTOAnalysis {}
+
+/// LLVMRustModuleCostBreakdown
+#[repr(C)]
+#[derive(Copy, Clone, Default, Debug)]
+pub struct ModuleCostBreakdown {
+    pub functions: u64,
+    pub instructions: u64,
+    pub basic_blocks: u64,
+    pub call_sites: u64,
+    pub max_loop_depth: u64,
+    pub bitcode_size: u64,
+}
+
+/// LLVMRustThinLTODataStats
+#[repr(C)]
+#[derive(Copy, Clone, Default, Debug)]
+pub struct ThinLTODataStats {
+    pub load_seconds: f64,
+    pub import_seconds: f64,
+    pub resolve_seconds: f64,
+}
+
+/// LLVMRustThinLTOModuleStats
+#[repr(C)]
+#[derive(Copy, Clone, Default, Debug)]
+pub struct ThinLTOModuleStats {
+    pub imported_functions: u64,
+    pub imported_globals: u64,
+    pub imported_instructions: u64,
+    pub source_modules: u64,
+    pub source_module_bytes: u64,
+    pub exports: u64,
+    pub exported_instructions: u64,
+    pub imported_by: u64,
+}
+
 /// LLVMRustThinLTOModule
 #[repr(C)]
 pub struct ThinLTOModule {
@@ -494,6 +556,12 @@ pub mod debuginfo {
 
 pub enum ModuleBuffer {}
 
+pub enum PassTimings {}
+
+pub enum ObjectBuffer {}
+
+pub enum ExportSet {}
+
 // Link to our native llvm bindings (things that we need to use the C++ api
 // for) and because llvm is written in C++ we need to link against libstdc++
 //
@@ -731,6 +799,9 @@ extern "C" {
                                               Name: *const c_char,
                                               Value: *const c_char);
     pub fn LLVMRustRemoveFunctionAttributes(Fn: ValueRef, index: c_uint, attr: Attribute);
+    pub fn LLVMRustAddFunctionAttributes(Fn: ValueRef,
+                                         Attrs: *const AttributeEntry,
+                                         NumAttrs: size_t);
 
     // Operations on parameters
     pub fn LLVMCountParams(Fn: ValueRef) -> c_uint;
@@ -755,6 +826,9 @@ extern "C" {
     pub fn LLVMSetInstructionCallConv(Instr: ValueRef, CC: c_uint);
     pub fn LLVMRustAddCallSiteAttribute(Instr: ValueRef, index: c_uint, attr: Attribute);
     pub fn LLVMRustAddDereferenceableCallSiteAttr(Instr: ValueRef, index: c_uint, bytes: u64);
+    pub fn LLVMRustAddCallSiteAttributes(Instr: ValueRef,
+                                         Attrs: *const AttributeEntry,
+                                         NumAttrs: size_t);
 
     // Operations on load/store instructions (only)
     pub fn LLVMSetVolatile(MemoryAccessInst: ValueRef, volatile: Bool);
@@ -1071,6 +1145,16 @@ extern "C" {
                              DestTy: TypeRef,
                              Name: *const c_char)
                              -> ValueRef;
+    pub fn LLVMRustBuildCallWithAttributes(B: BuilderRef,
+                                           Fn: ValueRef,
+                                           Args: *const ValueRef,
+                                           NumArgs: c_uint,
+                                           Bundle: OperandBundleDefRef,
+                                           Attrs: *const AttributeEntry,
+                                           NumAttrs: size_t,
+                                           CallConv: c_uint,
+                                           Name: *const c_char)
+                                           -> ValueRef;
     pub fn LLVMBuildIntToPtr(B: BuilderRef,
                              Val: ValueRef,
                              DestTy: TypeRef,
@@ -1578,6 +1662,21 @@ extern "C" {
     pub fn LLVMRustPassKind(Pass: PassRef) -> PassKind;
     pub fn LLVMRustFindAndCreatePass(Pass: *const c_char) -> PassRef;
     pub fn LLVMRustAddPass(PM: PassManagerRef, Pass: PassRef);
+    pub fn LLVMRustPassTimingsCreate() -> *mut PassTimings;
+    pub fn LLVMRustPassTimingsFree(T: *mut PassTimings);
+    pub fn LLVMRustPassTimingsRecordEvents(T: *mut PassTimings, MinNanos: u64);
+    pub fn LLVMRustPassTimingsEventCount(T: *const PassTimings) -> size_t;
+    pub fn LLVMRustPassTimingsGetEvent(T: *const PassTimings,
+                                       Index: size_t,
+                                       Function: *mut *const c_char,
+                                       StartNanos: *mut u64,
+                                       EndNanos: *mut u64)
+                                       -> *const c_char;
+    pub fn LLVMRustCreateTimedPassManager(T: *mut PassTimings) -> PassManagerRef;
+    pub fn LLVMRustCreateTimedFunctionPassManagerForModule(M: ModuleRef,
+                                                           T: *mut PassTimings)
+                                                           -> PassManagerRef;
+    pub fn LLVMRustPassTimingsWriteJSON(T: *const PassTimings, s: RustStringRef);
 
     pub fn LLVMRustHasFeature(T: TargetMachineRef, s: *const c_char) -> bool;
 
@@ -1596,6 +1695,18 @@ extern "C" {
                                        DataSections: bool)
                                        -> TargetMachineRef;
     pub fn LLVMRustDisposeTargetMachine(T: TargetMachineRef);
+    pub fn LLVMRustCheckoutTargetMachine(Triple: *const c_char,
+                                         CPU: *const c_char,
+                                         Features: *const c_char,
+                                         Model: CodeModel,
+                                         Reloc: RelocMode,
+                                         Level: CodeGenOptLevel,
+                                         UseSoftFP: bool,
+                                         PositionIndependentExecutable: bool,
+                                         FunctionSections: bool,
+                                         DataSections: bool)
+                                         -> TargetMachineRef;
+    pub fn LLVMRustReturnTargetMachine(T: TargetMachineRef);
     pub fn LLVMRustAddAnalysisPasses(T: TargetMachineRef, PM: PassManagerRef, M: ModuleRef);
     pub fn LLVMRustAddBuilderLibraryInfo(PMB: PassManagerBuilderRef,
                                          M: ModuleRef,
@@ -1604,17 +1715,41 @@ extern "C" {
                                                OptLevel: CodeGenOptLevel,
                                                MergeFunctions: bool,
                                                SLPVectorize: bool,
-                                               LoopVectorize: bool);
+                                               LoopVectorize: bool,
+                                               PGOGenPath: *const c_char,
+                                               PGOUsePath: *const c_char);
     pub fn LLVMRustAddLibraryInfo(PM: PassManagerRef,
                                   M: ModuleRef,
                                   DisableSimplifyLibCalls: bool);
     pub fn LLVMRustRunFunctionPassManager(PM: PassManagerRef, M: ModuleRef);
+    pub fn LLVMRustRunNewPassManagerPipeline(M: ModuleRef,
+                                             TM: TargetMachineRef,
+                                             OptLevel: PassBuilderOptLevel,
+                                             DisableSimplifyLibCalls: bool,
+                                             DebugLogging: bool)
+                                             -> bool;
+    pub fn LLVMRustEmbedBitcode(M: ModuleRef, Cmdline: *const c_char, CmdlineLen: size_t) -> bool;
     pub fn LLVMRustWriteOutputFile(T: TargetMachineRef,
                                    PM: PassManagerRef,
                                    M: ModuleRef,
                                    Output: *const c_char,
                                    FileType: FileType)
                                    -> LLVMRustResult;
+    pub fn LLVMRustTargetHasAsmParser(T: TargetMachineRef) -> bool;
+    pub fn LLVMRustWriteAssemblyAndObject(T: TargetMachineRef,
+                                          PM: PassManagerRef,
+                                          M: ModuleRef,
+                                          AsmOutput: *const c_char,
+                                          ObjOutput: *const c_char)
+                                          -> LLVMRustResult;
+    pub fn LLVMRustWriteOutputToBuffer(T: TargetMachineRef,
+                                       PM: PassManagerRef,
+                                       M: ModuleRef,
+                                       FileType: FileType)
+                                       -> *mut ObjectBuffer;
+    pub fn LLVMRustObjectBufferPtr(B: *const ObjectBuffer) -> *const u8;
+    pub fn LLVMRustObjectBufferLen(B: *const ObjectBuffer) -> size_t;
+    pub fn LLVMRustObjectBufferFree(B: *mut ObjectBuffer);
     pub fn LLVMRustPrintModule(PM: PassManagerRef,
                                M: ModuleRef,
                                Output: *const c_char,
@@ -1627,9 +1762,19 @@ extern "C" {
     pub fn LLVMRustSetNormalizedTarget(M: ModuleRef, triple: *const c_char);
     pub fn LLVMRustAddAlwaysInlinePass(P: PassManagerBuilderRef, AddLifetimes: bool);
     pub fn LLVMRustLinkInExternalBitcode(M: ModuleRef, bc: *const c_char, len: size_t) -> bool;
+    pub fn LLVMRustLinkInExternalBitcodes(M: ModuleRef,
+                                          bcs: *const *const c_char,
+                                          lens: *const size_t,
+                                          identifiers: *const *const c_char,
+                                          num: size_t) -> bool;
     pub fn LLVMRustLinkInParsedExternalBitcode(M: ModuleRef, M: ModuleRef) -> bool;
-    pub fn LLVMRustRunRestrictionPass(M: ModuleRef, syms: *const *const c_char, len: size_t);
+    pub fn LLVMRustExportSetCreate(Symbols: *const *const c_char,
+                                   Len: size_t) -> *mut ExportSet;
+    pub fn LLVMRustExportSetFree(Exports: *mut ExportSet);
+    pub fn LLVMRustRunRestrictionPass(M: ModuleRef, Exports: *const ExportSet);
     pub fn LLVMRustMarkAllFunctionsNounwind(M: ModuleRef);
+    pub fn LLVMRustMergeIdenticalFunctions(M: ModuleRef) -> c_uint;
+    pub fn LLVMRustExpandTargetClones(M: ModuleRef, TM: TargetMachineRef) -> bool;
 
     pub fn LLVMRustOpenArchive(path: *const c_char) -> ArchiveRef;
     pub fn LLVMRustArchiveIteratorNew(AR: ArchiveRef) -> ArchiveIteratorRef;
@@ -1681,6 +1826,10 @@ extern "C" {
                                     Name: *const c_char,
                                     Child: ArchiveChildRef)
                                     -> RustArchiveMemberRef;
+    pub fn LLVMRustArchiveMemberNewFromBuffer(Name: *const c_char,
+                                              Data: *const c_char,
+                                              Len: size_t)
+                                              -> RustArchiveMemberRef;
     pub fn LLVMRustArchiveMemberFree(Member: RustArchiveMemberRef);
 
     pub fn LLVMRustSetDataLayoutFromTargetMachine(M: ModuleRef, TM: TargetMachineRef);
@@ -1701,7 +1850,7 @@ extern "C" {
     pub fn LLVMRustModuleBufferPtr(p: *const ModuleBuffer) -> *const u8;
     pub fn LLVMRustModuleBufferLen(p: *const ModuleBuffer) -> usize;
     pub fn LLVMRustModuleBufferFree(p: *mut ModuleBuffer);
-    pub fn LLVMRustModuleCost(M: ModuleRef) -> u64;
+    pub fn LLVMRustModuleCost(M: ModuleRef, Cost: *mut ModuleCostBreakdown);
 
     pub fn LLVMRustThinLTOAvailable() -> bool;
     pub fn LLVMRustWriteThinBitcodeToFile(PMR: PassManagerRef,
@@ -1714,8 +1863,9 @@ extern "C" {
     pub fn LLVMRustCreateThinLTOData(
         Modules: *const ThinLTOModule,
         NumModules: c_uint,
-        PreservedSymbols: *const *const c_char,
-        PreservedSymbolsLen: c_uint,
+        Exports: *const ExportSet,
+        PreserveRootsOnly: bool,
+        MaxThreads: c_uint,
     ) -> *mut ThinLTOData;
     pub fn LLVMRustPrepareThinLTORename(
         Data: *const ThinLTOData,
@@ -1734,6 +1884,46 @@ extern "C" {
         Module: ModuleRef,
     ) -> bool;
     pub fn LLVMRustFreeThinLTOData(Data: *mut ThinLTOData);
+    pub fn LLVMRustThinLTOGetDataStats(Data: *const ThinLTOData, Stats: *mut ThinLTODataStats);
+    pub fn LLVMRustThinLTOGetModuleStats(
+        Data: *const ThinLTOData,
+        ModuleId: *const c_char,
+        Stats: *mut ThinLTOModuleStats,
+    );
+    pub fn LLVMRustThinLTOHashModules(Data: *mut ThinLTOData);
+    pub fn LLVMRustThinLTOGetCacheKey(
+        Data: *const ThinLTOData,
+        ModuleId: *const c_char,
+        KeyOut: RustStringRef,
+    ) -> bool;
+    pub fn LLVMRustThinLTOWriteAnalysis(
+        Data: *mut ThinLTOData,
+        Path: *const c_char,
+        Tag: *const c_char,
+    ) -> bool;
+    pub fn LLVMRustThinLTOReadAnalysis(
+        Path: *const c_char,
+        Tag: *const c_char,
+    ) -> *mut ThinLTOAnalysis;
+    pub fn LLVMRustThinLTOFreeAnalysis(Analysis: *mut ThinLTOAnalysis);
+    pub fn LLVMRustThinLTOLoadIndexShard(
+        IndexPath: *const c_char,
+        ModulePath: *const c_char,
+    ) -> *mut ThinLTOData;
+    pub fn LLVMRustThinLTOWriteIndexShard(
+        Data: *const ThinLTOData,
+        ModuleId: *const c_char,
+        ModuleIds: *const *const c_char,
+        ModulePaths: *const *const c_char,
+        NumModules: size_t,
+        IndexPath: *const c_char,
+        ImportsPath: *const c_char,
+    ) -> bool;
+    pub fn LLVMRustThinLTOModuleUnchanged(
+        Data: *const ThinLTOData,
+        Previous: *const ThinLTOAnalysis,
+        ModuleId: *const c_char,
+    ) -> bool;
     pub fn LLVMRustParseBitcodeForThinLTO(
         Context: ContextRef,
         Data: *const u8,
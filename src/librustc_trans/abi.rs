@@ -38,8 +38,9 @@ use rustc::hir;
 use rustc::ty::{self, Ty};
 use rustc::ty::layout::{self, Layout, LayoutTyper, TyLayout, Size};
 use rustc_back::PanicStrategy;
+use rustc_data_structures::small_vec::SmallVec;
 
-use libc::c_uint;
+use libc::{c_uint, size_t};
 use std::cmp;
 use std::iter;
 
@@ -113,28 +114,25 @@ impl ArgAttributes {
         self
     }
 
-    pub fn apply_llfn(&self, idx: AttributePlace, llfn: ValueRef) {
-        unsafe {
-            self.regular.for_each_kind(|attr| attr.apply_llfn(idx, llfn));
-            if self.dereferenceable_bytes != 0 {
-                llvm::LLVMRustAddDereferenceableAttr(llfn,
-                                                     idx.as_uint(),
-                                                     self.dereferenceable_bytes);
-            }
-        }
-    }
-
-    pub fn apply_callsite(&self, idx: AttributePlace, callsite: ValueRef) {
-        unsafe {
-            self.regular.for_each_kind(|attr| attr.apply_callsite(idx, callsite));
-            if self.dereferenceable_bytes != 0 {
-                llvm::LLVMRustAddDereferenceableCallSiteAttr(callsite,
-                                                             idx.as_uint(),
-                                                             self.dereferenceable_bytes);
-            }
+    fn push_entries(&self, idx: AttributePlace, entries: &mut AttributeEntries) {
+        let index = idx.as_uint();
+        self.regular.for_each_kind(|kind| {
+            entries.push(llvm::AttributeEntry { index, kind, value: 0 });
+        });
+        if self.dereferenceable_bytes != 0 {
+            entries.push(llvm::AttributeEntry {
+                index,
+                kind: llvm::Attribute::Dereferenceable,
+                value: self.dereferenceable_bytes,
+            });
         }
     }
 }
+
+/// The attributes of a whole function or call site, which are handed to LLVM
+/// in one go rather than one by one, as every addition has LLVM rebuild the
+/// whole attribute list.
+pub type AttributeEntries = SmallVec<[llvm::AttributeEntry; 8]>;
 #[derive(Copy, Clone, PartialEq, Eq, Debug)]
 pub enum RegKind {
     Integer,
@@ -960,32 +958,42 @@ impl<'a, 'tcx> FnType<'tcx> {
         }
     }
 
-    pub fn apply_attrs_llfn(&self, llfn: ValueRef) {
+    /// The attributes of the return value and the arguments, grouped by index.
+    pub fn attribute_entries(&self) -> AttributeEntries {
+        let mut entries = AttributeEntries::new();
         let mut i = if self.ret.is_indirect() { 1 } else { 0 };
         if !self.ret.is_ignore() {
-            self.ret.attrs.apply_llfn(llvm::AttributePlace::Argument(i), llfn);
+            self.ret.attrs.push_entries(llvm::AttributePlace::Argument(i), &mut entries);
         }
         i += 1;
         for arg in &self.args {
             if !arg.is_ignore() {
                 if arg.pad.is_some() { i += 1; }
-                arg.attrs.apply_llfn(llvm::AttributePlace::Argument(i), llfn);
+                arg.attrs.push_entries(llvm::AttributePlace::Argument(i), &mut entries);
                 i += 1;
             }
         }
+        entries
     }
 
-    pub fn apply_attrs_callsite(&self, callsite: ValueRef) {
-        let mut i = if self.ret.is_indirect() { 1 } else { 0 };
-        if !self.ret.is_ignore() {
-            self.ret.attrs.apply_callsite(llvm::AttributePlace::Argument(i), callsite);
+    pub fn apply_attrs_llfn(&self, llfn: ValueRef) {
+        let entries = self.attribute_entries();
+        if !entries.is_empty() {
+            unsafe {
+                llvm::LLVMRustAddFunctionAttributes(llfn,
+                                                    entries.as_ptr(),
+                                                    entries.len() as size_t);
+            }
         }
-        i += 1;
-        for arg in &self.args {
-            if !arg.is_ignore() {
-                if arg.pad.is_some() { i += 1; }
-                arg.attrs.apply_callsite(llvm::AttributePlace::Argument(i), callsite);
-                i += 1;
+    }
+
+    pub fn apply_attrs_callsite(&self, callsite: ValueRef) {
+        let entries = self.attribute_entries();
+        if !entries.is_empty() {
+            unsafe {
+                llvm::LLVMRustAddCallSiteAttributes(callsite,
+                                                    entries.as_ptr(),
+                                                    entries.len() as size_t);
             }
         }
 
@@ -92,6 +92,24 @@ pub fn set_probestack(ccx: &CrateContext, llfn: ValueRef) {
         cstr("probe-stack\0"), cstr("__rust_probestack\0"));
 }
 
+/// Ask for `#[target_clones = "..."]` functions to be multiversioned. The value
+/// is a `;`-separated list of feature sets in the syntax `#[target_feature]`
+/// uses, in order of preference. The clones are expanded before the module is
+/// optimized; on targets without ifunc support only the default is emitted.
+fn target_clones(ccx: &CrateContext, llfn: ValueRef, clones: &str) {
+    let target = &ccx.sess().target.target;
+    let supported = (target.arch == "x86" || target.arch == "x86_64") &&
+                    target.target_os == "linux" &&
+                    target.target_env == "gnu";
+    if !supported || clones.contains('\0') {
+        return
+    }
+    let val = CString::new(clones).unwrap();
+    llvm::AddFunctionAttrStringValue(
+        llfn, llvm::AttributePlace::Function,
+        cstr("rust-target-clones\0"), &val);
+}
+
 /// Composite function which sets LLVM attributes for function depending on its AST (#[attribute])
 /// attributes.
 pub fn from_fn_attrs(ccx: &CrateContext, attrs: &[ast::Attribute], llfn: ValueRef) {
@@ -110,6 +128,10 @@ pub fn from_fn_attrs(ccx: &CrateContext, attrs: &[ast::Attribute], llfn: ValueRe
                     }
                 }
             }
+        } else if attr.check_name("target_clones") {
+            if let Some(val) = attr.value_str() {
+                target_clones(ccx, llfn, &val.as_str());
+            }
         } else if attr.check_name("cold") {
             Attribute::Cold.apply_llfn(Function, llfn);
         } else if attr.check_name("naked") {
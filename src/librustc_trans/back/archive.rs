@@ -16,8 +16,10 @@ use std::mem;
 use std::path::{Path, PathBuf};
 use std::ptr;
 use std::str;
+use std::sync::Arc;
 
 use back::bytecode::RLIB_BYTECODE_EXTENSION;
+use back::write::ObjectBuffer;
 use libc;
 use llvm::archive_ro::{ArchiveRO, Child};
 use llvm::{self, ArchiveKind};
@@ -47,6 +49,10 @@ enum Addition {
         path: PathBuf,
         name_in_archive: String,
     },
+    Buffer {
+        data: Arc<ObjectBuffer>,
+        name_in_archive: String,
+    },
     Archive {
         archive: ArchiveRO,
         skip: Box<FnMut(&str) -> bool>,
@@ -201,6 +207,15 @@ impl<'a> ArchiveBuilder<'a> {
         });
     }
 
+    /// Adds an object file that was kept in memory to this archive, as if it
+    /// had been written to a file called `name`.
+    pub fn add_buffer(&mut self, data: Arc<ObjectBuffer>, name: &str) {
+        self.additions.push(Addition::Buffer {
+            data,
+            name_in_archive: name.to_string(),
+        });
+    }
+
     /// Indicate that the next call to `build` should updates all symbols in
     /// the archive (run 'ar s' over it).
     pub fn update_symbols(&mut self) {
@@ -232,6 +247,7 @@ impl<'a> ArchiveBuilder<'a> {
     fn build_with_llvm(&mut self, kind: ArchiveKind) -> io::Result<()> {
         let mut archives = Vec::new();
         let mut strings = Vec::new();
+        let mut buffers = Vec::new();
         let mut members = Vec::new();
         let removals = mem::replace(&mut self.removals, Vec::new());
 
@@ -265,6 +281,16 @@ impl<'a> ArchiveBuilder<'a> {
                         strings.push(path);
                         strings.push(name);
                     }
+                    Addition::Buffer { data, name_in_archive } => {
+                        let name = CString::new(name_in_archive)?;
+                        let bytes = data.data();
+                        members.push(llvm::LLVMRustArchiveMemberNewFromBuffer(
+                            name.as_ptr(),
+                            bytes.as_ptr() as *const libc::c_char,
+                            bytes.len() as libc::size_t));
+                        strings.push(name);
+                        buffers.push(data);
+                    }
                     Addition::Archive { archive, mut skip } => {
                         for child in archive.iter() {
                             let child = child.map_err(string_to_io_error)?;
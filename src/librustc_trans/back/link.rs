@@ -175,7 +175,7 @@ pub fn link_binary(sess: &Session,
     // Remove the temporary object file and metadata if we aren't saving temps
     if !sess.opts.cg.save_temps {
         if sess.opts.output_types.should_trans() {
-            for obj in trans.modules.iter() {
+            for obj in trans.modules.iter().filter(|obj| obj.object_data.is_none()) {
                 remove(sess, &obj.object);
             }
         }
@@ -356,7 +356,13 @@ fn link_rlib<'a>(sess: &'a Session,
     let mut ab = ArchiveBuilder::new(archive_config(sess, out_filename, None));
 
     for module in trans.modules.iter() {
-        ab.add_file(&module.object);
+        match module.object_data {
+            Some(ref data) => {
+                let name = module.object.file_name().unwrap().to_str().unwrap();
+                ab.add_buffer(data.clone(), name);
+            }
+            None => ab.add_file(&module.object),
+        }
     }
 
     // Note that in this loop we are ignoring the value of `lib.cfg`. That is,
@@ -962,6 +968,11 @@ fn link_args(cmd: &mut Linker,
     // Pass debuginfo flags down to the linker.
     cmd.debuginfo();
 
+    // Make sure the profiler runtime is linked in when generating PGO data.
+    if sess.opts.debugging_opts.pgo_gen.is_some() {
+        cmd.pgo_gen();
+    }
+
     // We want to prevent the compiler from accidentally leaking in any system
     // libraries, so we explicitly ask gcc to not link to any libraries by
     // default. Note that this does not happen for windows because windows pulls
@@ -112,6 +112,7 @@ pub trait Linker {
     fn args(&mut self, args: &[String]);
     fn export_symbols(&mut self, tmpdir: &Path, crate_type: CrateType);
     fn subsystem(&mut self, subsystem: &str);
+    fn pgo_gen(&mut self);
     // Should have been finalize(self), but we don't support self-by-value on trait objects (yet?).
     fn finalize(&mut self) -> Command;
 }
@@ -370,6 +371,17 @@ impl<'a> Linker for GccLinker<'a> {
         self.linker_arg(&format!("--subsystem,{}", subsystem));
     }
 
+    fn pgo_gen(&mut self) {
+        if !self.sess.target.target.options.linker_is_gnu { return }
+
+        // LLVM doesn't reference the profiler runtime from instrumented code
+        // on Linux, as clang asks the linker to pull it in instead. Do the
+        // same thing here; it's harmless on targets where LLVM does add the
+        // reference itself.
+        self.cmd.arg("-u");
+        self.cmd.arg("__llvm_profile_runtime");
+    }
+
     fn finalize(&mut self) -> Command {
         self.hint_dynamic(); // Reset to default before returning the composed command line.
         let mut cmd = Command::new("");
@@ -587,6 +599,11 @@ impl<'a> Linker for MsvcLinker<'a> {
         }
     }
 
+    fn pgo_gen(&mut self) {
+        // Nothing needed here, instrumented code references the profiler
+        // runtime itself.
+    }
+
     fn finalize(&mut self) -> Command {
         let mut cmd = Command::new("");
         ::std::mem::swap(&mut cmd, &mut self.cmd);
@@ -737,6 +754,10 @@ impl<'a> Linker for EmLinker<'a> {
         // noop
     }
 
+    fn pgo_gen(&mut self) {
+        // noop, but maybe we need something like the gnu linker?
+    }
+
     fn finalize(&mut self) -> Command {
         let mut cmd = Command::new("");
         ::std::mem::swap(&mut cmd, &mut self.cmd);
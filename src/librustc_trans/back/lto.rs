@@ -18,16 +18,25 @@ use llvm::{ModuleRef, TargetMachineRef, True, False};
 use llvm;
 use rustc::hir::def_id::LOCAL_CRATE;
 use rustc::middle::exported_symbols::SymbolExportLevel;
-use rustc::session::config;
-use rustc::util::common::time;
+use rustc::session::config::{self, OutputFilenames};
+use rustc::util::common::{time, path2cstr};
+use rustc_incremental::in_incr_comp_dir;
+use serialize::json::{self, Json};
 use time_graph::Timeline;
 use {ModuleTranslation, ModuleLlvm, ModuleKind, ModuleSource};
 
 use libc;
 
-use std::ffi::CString;
+use std::collections::BTreeMap;
+use std::collections::hash_map::DefaultHasher;
+use std::ffi::{CStr, CString};
+use std::fs::File;
+use std::hash::{Hash, Hasher};
+use std::io::{self, Read, Write};
+use std::path::{Path, PathBuf};
 use std::slice;
-use std::sync::Arc;
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
 
 pub fn crate_type_allows_lto(crate_type: config::CrateType) -> bool {
     match crate_type {
@@ -75,7 +84,7 @@ impl LtoModuleTranslation {
                 let config = cgcx.config(trans.kind);
                 let llmod = trans.llvm().unwrap().llmod;
                 let tm = trans.llvm().unwrap().tm;
-                run_pass_manager(cgcx, tm, llmod, config, false);
+                run_pass_manager(cgcx, tm, llmod, config, false, &trans.name);
                 timeline.record("fat-done");
                 Ok(trans)
             }
@@ -83,6 +92,24 @@ impl LtoModuleTranslation {
         }
     }
 
+    /// The key under which the object file for this module is stored in the
+    /// ThinLTO cache, if `-Z thinlto-cache-dir` is in use.
+    pub fn cache_key(&self) -> Option<&str> {
+        match *self {
+            LtoModuleTranslation::Fat { .. } => None,
+            LtoModuleTranslation::Thin(ref m) => m.cache_key(),
+        }
+    }
+
+    /// Whether this module will come out of ThinLTO exactly as it did in the
+    /// previous incremental compilation session.
+    pub fn unchanged_since_last_session(&self) -> bool {
+        match *self {
+            LtoModuleTranslation::Fat { .. } => false,
+            LtoModuleTranslation::Thin(ref m) => m.unchanged_since_last_session(),
+        }
+    }
+
     /// A "guage" of how costly it is to optimize this module, used to sort
     /// biggest modules first.
     pub fn cost(&self) -> u64 {
@@ -99,9 +126,12 @@ pub enum LTOMode {
     JustThisCrate,
 }
 
+/// `threads` is how many threads the work that can happen in parallel here
+/// may use, which is the number of jobserver tokens the caller holds.
 pub fn run(cgcx: &CodegenContext,
            modules: Vec<ModuleTranslation>,
            mode: LTOMode,
+           threads: usize,
            timeline: &mut Timeline)
     -> Result<Vec<LtoModuleTranslation>, FatalError>
 {
@@ -183,13 +213,14 @@ pub fn run(cgcx: &CodegenContext,
         }
     }
 
-    let arr = symbol_white_list.iter().map(|c| c.as_ptr()).collect::<Vec<_>>();
+    let exports = ExportSet::new(&symbol_white_list);
+    timeline.record("export set");
     match mode {
         LTOMode::WholeCrateGraph if !cgcx.thinlto => {
-            fat_lto(cgcx, &diag_handler, modules, upstream_modules, &arr, timeline)
+            fat_lto(cgcx, &diag_handler, modules, upstream_modules, &exports, timeline)
         }
         _ => {
-            thin_lto(&diag_handler, modules, upstream_modules, &arr, timeline)
+            thin_lto(cgcx, &diag_handler, modules, upstream_modules, &exports, threads, timeline)
         }
     }
 }
@@ -198,7 +229,7 @@ fn fat_lto(cgcx: &CodegenContext,
            diag_handler: &Handler,
            mut modules: Vec<ModuleTranslation>,
            mut serialized_modules: Vec<(SerializedModule, CString)>,
-           symbol_white_list: &[*const libc::c_char],
+           exports: &ExportSet,
            timeline: &mut Timeline)
     -> Result<Vec<LtoModuleTranslation>, FatalError>
 {
@@ -217,10 +248,7 @@ fn fat_lto(cgcx: &CodegenContext,
         .enumerate()
         .filter(|&(_, module)| module.kind == ModuleKind::Regular)
         .map(|(i, module)| {
-            let cost = unsafe {
-                llvm::LLVMRustModuleCost(module.llvm().unwrap().llmod)
-            };
-            (cost, i)
+            (write::llvm_module_cost(module.llvm().unwrap().llmod), i)
         })
         .max()
         .expect("must be trans'ing at least one module");
@@ -241,35 +269,41 @@ fn fat_lto(cgcx: &CodegenContext,
     }
 
     // For all serialized bitcode files we parse them and link them in as we did
-    // above, this is all mostly handled in C++. Like above, though, we don't
-    // know much about the memory management here so we err on the side of being
-    // save and persist everything with the original module.
-    let mut serialized_bitcode = Vec::new();
-    for (bc_decoded, name) in serialized_modules {
+    // above, this is all mostly handled in C++. Everything is linked in one
+    // call so LLVM only sets up the linker once, and the bitcode is borrowed
+    // rather than copied on the C++ side, it only has to outlive the call.
+    let mut bcs = Vec::with_capacity(serialized_modules.len());
+    let mut lens = Vec::with_capacity(serialized_modules.len());
+    let mut names = Vec::with_capacity(serialized_modules.len());
+    for &(ref bc_decoded, ref name) in serialized_modules.iter() {
         info!("linking {:?}", name);
-        time(cgcx.time_passes, &format!("ll link {:?}", name), || unsafe {
-            let data = bc_decoded.data();
-            if llvm::LLVMRustLinkInExternalBitcode(llmod,
-                                                   data.as_ptr() as *const libc::c_char,
-                                                   data.len() as libc::size_t) {
-                Ok(())
-            } else {
-                let msg = format!("failed to load bc of {:?}", name);
-                Err(write::llvm_err(&diag_handler, msg))
-            }
-        })?;
-        timeline.record(&format!("link {:?}", name));
-        serialized_bitcode.push(bc_decoded);
+        let data = bc_decoded.data();
+        bcs.push(data.as_ptr() as *const libc::c_char);
+        lens.push(data.len() as libc::size_t);
+        names.push(name.as_ptr());
     }
+    time(cgcx.time_passes, "ll link", || unsafe {
+        if llvm::LLVMRustLinkInExternalBitcodes(llmod,
+                                                bcs.as_ptr(),
+                                                lens.as_ptr(),
+                                                names.as_ptr(),
+                                                bcs.len() as libc::size_t) {
+            Ok(())
+        } else {
+            let msg = format!("failed to load bc of upstream modules");
+            Err(write::llvm_err(&diag_handler, msg))
+        }
+    })?;
+    timeline.record("link");
+    let serialized_bitcode = serialized_modules.into_iter()
+        .map(|(bc_decoded, _)| bc_decoded)
+        .collect::<Vec<_>>();
     cgcx.save_temp_bitcode(&module, "lto.input");
 
     // Internalize everything that *isn't* in our whitelist to help strip out
     // more modules and such
     unsafe {
-        let ptr = symbol_white_list.as_ptr();
-        llvm::LLVMRustRunRestrictionPass(llmod,
-                                         ptr as *const *const libc::c_char,
-                                         symbol_white_list.len() as libc::size_t);
+        llvm::LLVMRustRunRestrictionPass(llmod, exports.0);
         cgcx.save_temp_bitcode(&module, "lto.after-restriction");
     }
 
@@ -317,10 +351,12 @@ fn fat_lto(cgcx: &CodegenContext,
 /// calculating the *index* for ThinLTO. This index will then be shared amongst
 /// all of the `LtoModuleTranslation` units returned below and destroyed once
 /// they all go out of scope.
-fn thin_lto(diag_handler: &Handler,
+fn thin_lto(cgcx: &CodegenContext,
+            diag_handler: &Handler,
             modules: Vec<ModuleTranslation>,
             serialized_modules: Vec<(SerializedModule, CString)>,
-            symbol_white_list: &[*const libc::c_char],
+            exports: &ExportSet,
+            threads: usize,
             timeline: &mut Timeline)
     -> Result<Vec<LtoModuleTranslation>, FatalError>
 {
@@ -386,12 +422,18 @@ fn thin_lto(diag_handler: &Handler,
         // tried-and-true interface we may wish to try to upstream some of this
         // to LLVM itself, right now we reimplement a lot of what they do
         // upstream...
-        let data = llvm::LLVMRustCreateThinLTOData(
-            thin_modules.as_ptr(),
-            thin_modules.len() as u32,
-            symbol_white_list.as_ptr(),
-            symbol_white_list.len() as u32,
-        );
+        //
+        // Note that loading all module summaries happens on up to `threads`
+        // threads in here, but everything after that is serial.
+        let data = time(cgcx.time_passes, "thin lto: summaries and index", || {
+            llvm::LLVMRustCreateThinLTOData(
+                thin_modules.as_ptr(),
+                thin_modules.len() as u32,
+                exports.0,
+                cgcx.opts.debugging_opts.thinlto_preserve_roots_only,
+                threads as u32,
+            )
+        });
         if data.is_null() {
             let msg = format!("failed to prepare thin LTO context");
             return Err(write::llvm_err(&diag_handler, msg))
@@ -400,6 +442,61 @@ fn thin_lto(diag_handler: &Handler,
         info!("thin LTO data created");
         timeline.record("data");
 
+        if cgcx.opts.debugging_opts.thinlto_emit_index {
+            emit_index_shards(cgcx, diag_handler, &data, &thin_modules)?;
+            timeline.record("index-shards");
+        }
+
+        // If we're reusing optimized objects across compilations then now's
+        // the time to figure out what can be reused, as we've still got
+        // exclusive access to the data. LLVM hashes the module along with
+        // everything it imports, exports, and how its symbols were resolved,
+        // and on top of that we mix in anything else which influences how the
+        // module is optimized and code generated.
+        let cache_dir = cgcx.opts.debugging_opts.thinlto_cache_dir.is_some();
+        let incremental = cgcx.incr_comp_session_dir.is_some();
+        let salt = thinlto_cache_salt(cgcx);
+        if cache_dir || incremental {
+            llvm::LLVMRustThinLTOHashModules(data.0);
+        }
+        let cache_keys = if cache_dir {
+            let keys = module_names.iter().map(|name| {
+                let mut found = false;
+                let key = llvm::build_string(|s| {
+                    found = llvm::LLVMRustThinLTOGetCacheKey(data.0, name.as_ptr(), s);
+                });
+                match key {
+                    Some(ref key) if found => Some(format!("{}-{:016x}", key, salt)),
+                    _ => None,
+                }
+            }).collect();
+            timeline.record("cache-keys");
+            keys
+        } else {
+            Vec::new()
+        };
+        let unchanged = match cgcx.incr_comp_session_dir {
+            Some(ref dir) => {
+                let unchanged = diff_with_previous_session(cgcx,
+                                                           diag_handler,
+                                                           &data,
+                                                           &module_names,
+                                                           dir,
+                                                           salt);
+                timeline.record("diff-analysis");
+                unchanged
+            }
+            None => Vec::new(),
+        };
+
+        let report = if cgcx.opts.debugging_opts.thinlto_report {
+            let report = start_report(cgcx, diag_handler, &data, &module_names)?;
+            timeline.record("report");
+            Some(report)
+        } else {
+            None
+        };
+
         // Throw our data in an `Arc` as we'll be sharing it across threads. We
         // also put all memory referenced by the C++ data (buffers, ids, etc)
         // into the arc as well. After this we'll create a thin module
@@ -409,6 +506,10 @@ fn thin_lto(diag_handler: &Handler,
             thin_buffers,
             serialized_modules: serialized,
             module_names,
+            module_ids: Vec::new(),
+            cache_keys,
+            unchanged,
+            report,
         });
         Ok((0..shared.module_names.len()).map(|i| {
             LtoModuleTranslation::Thin(ThinModule {
@@ -419,11 +520,268 @@ fn thin_lto(diag_handler: &Handler,
     }
 }
 
+/// Writes out everything needed to run the ThinLTO backend for each module in
+/// a separate process, as with LLVM's distributed ThinLTO: the module's
+/// bitcode, an index shard with all summaries it needs, and the list of
+/// modules it imports from.
+///
+/// Both the index shards and the import lists refer to modules by the path
+/// their bitcode was written to, so a backend can load them directly.
+unsafe fn emit_index_shards(cgcx: &CodegenContext,
+                            diag_handler: &Handler,
+                            data: &ThinData,
+                            modules: &[llvm::ThinLTOModule])
+    -> Result<(), FatalError>
+{
+    let paths = modules.iter().map(|module| {
+        let name = CStr::from_ptr(module.identifier).to_str().unwrap();
+        index_shard_paths(&cgcx.output_filenames, name)
+    }).collect::<Vec<_>>();
+    let input_cstrs = paths.iter().map(|p| path2cstr(&p.0)).collect::<Vec<_>>();
+    let input_ptrs = input_cstrs.iter().map(|p| p.as_ptr()).collect::<Vec<_>>();
+    let id_ptrs = modules.iter().map(|m| m.identifier).collect::<Vec<_>>();
+
+    for (module, &(ref input, ref index, ref imports)) in modules.iter().zip(&paths) {
+        let name = CStr::from_ptr(module.identifier);
+        let bitcode = slice::from_raw_parts(module.data, module.len);
+        if let Err(e) = File::create(input).and_then(|mut f| f.write_all(bitcode)) {
+            let msg = format!("failed to write {}: {}", input.display(), e);
+            return Err(diag_handler.fatal(&msg))
+        }
+
+        let index_c = path2cstr(index);
+        let imports_c = path2cstr(imports);
+        if !llvm::LLVMRustThinLTOWriteIndexShard(data.0,
+                                                 module.identifier,
+                                                 id_ptrs.as_ptr(),
+                                                 input_ptrs.as_ptr(),
+                                                 id_ptrs.len() as libc::size_t,
+                                                 index_c.as_ptr(),
+                                                 imports_c.as_ptr()) {
+            let msg = format!("failed to write thin LTO index for {:?}", name);
+            return Err(write::llvm_err(diag_handler, msg))
+        }
+    }
+    Ok(())
+}
+
+/// The files `-Z thinlto-emit-index` writes for the module `name`: its bitcode,
+/// its index shard, and the list of modules it imports from.
+pub fn index_shard_paths(outputs: &OutputFilenames, name: &str) -> (PathBuf, PathBuf, PathBuf) {
+    (outputs.temp_path_ext("thinlto-input.bc", Some(name)),
+     outputs.temp_path_ext("thinlto.bc", Some(name)),
+     outputs.temp_path_ext("imports", Some(name)))
+}
+
+/// What a separate rustc process needs to know to run the ThinLTO backend for
+/// one module, on top of the command line it shares with the compilation that
+/// spawned it. It's handed over as a JSON file with `-Z thinlto-backend-job`.
+#[derive(RustcEncodable, RustcDecodable)]
+pub struct BackendJob {
+    pub name: String,
+    pub out_directory: PathBuf,
+    pub out_filestem: String,
+    pub single_output_file: Option<PathBuf>,
+    pub extra: String,
+    pub no_builtins: bool,
+    pub emit_bc: bool,
+    pub plugin_passes: Vec<String>,
+    pub total_cgus: usize,
+}
+
+impl BackendJob {
+    pub fn write(&self, path: &Path) -> io::Result<()> {
+        let encoded = json::encode(self).map_err(|e| {
+            io::Error::new(io::ErrorKind::Other, e.to_string())
+        })?;
+        File::create(path)?.write_all(encoded.as_bytes())
+    }
+
+    pub fn read(path: &Path) -> io::Result<BackendJob> {
+        let mut encoded = String::new();
+        File::open(path)?.read_to_string(&mut encoded)?;
+        json::decode(&encoded).map_err(|e| {
+            io::Error::new(io::ErrorKind::InvalidData, e.to_string())
+        })
+    }
+}
+
+/// Prepares the ThinLTO backend for the module `name` from the bitcode and
+/// index shard `-Z thinlto-emit-index` wrote for it, loading the modules it
+/// imports from their own bitcode files. This is what a backend job runs in
+/// place of the whole-program analysis in `thin_lto`.
+pub fn thin_lto_from_index_shard(cgcx: &CodegenContext,
+                                 diag_handler: &Handler,
+                                 name: &str)
+    -> Result<LtoModuleTranslation, FatalError>
+{
+    let (input, index, _) = index_shard_paths(&cgcx.output_filenames, name);
+    let mut bitcode = Vec::new();
+    if let Err(e) = File::open(&input).and_then(|mut f| f.read_to_end(&mut bitcode)) {
+        let msg = format!("failed to read {}: {}", input.display(), e);
+        return Err(diag_handler.fatal(&msg))
+    }
+
+    // The index refers to modules by the path of their bitcode, so that's
+    // also the identifier this module has to be parsed with.
+    let input_c = path2cstr(&input);
+    let index_c = path2cstr(&index);
+    let data = unsafe {
+        llvm::LLVMRustThinLTOLoadIndexShard(index_c.as_ptr(), input_c.as_ptr())
+    };
+    if data.is_null() {
+        let msg = format!("failed to load thin LTO index {}", index.display());
+        return Err(write::llvm_err(diag_handler, msg))
+    }
+    let shared = Arc::new(ThinShared {
+        data: ThinData(data),
+        thin_buffers: Vec::new(),
+        serialized_modules: vec![SerializedModule::FromFile(bitcode)],
+        module_names: vec![CString::new(name).unwrap()],
+        module_ids: vec![input_c],
+        cache_keys: Vec::new(),
+        unchanged: Vec::new(),
+        report: None,
+    });
+    Ok(LtoModuleTranslation::Thin(ThinModule {
+        shared,
+        idx: 0,
+    }))
+}
+
+/// Creates the `-Z thinlto-report` file and writes out everything known after
+/// the global analysis: how long each phase took and, for every module, what
+/// it imports and how much other modules import from it.
+///
+/// The report is in the JSON lines format, one object per line, so the
+/// per-module backend timings can be appended as modules finish optimizing.
+unsafe fn start_report(cgcx: &CodegenContext,
+                       diag_handler: &Handler,
+                       data: &ThinData,
+                       module_names: &[CString])
+    -> Result<Mutex<File>, FatalError>
+{
+    let path = cgcx.output_filenames.temp_path_ext("thin-lto-report.json", None);
+    let file = File::create(&path).map_err(|e| {
+        let msg = format!("failed to create {}: {}", path.display(), e);
+        diag_handler.fatal(&msg)
+    })?;
+    let report = Mutex::new(file);
+
+    let mut stats = llvm::ThinLTODataStats::default();
+    llvm::LLVMRustThinLTOGetDataStats(data.0, &mut stats);
+    write_report_line(&report, "summary", None, vec![
+        ("modules", Json::U64(module_names.len() as u64)),
+        ("load_seconds", Json::F64(stats.load_seconds)),
+        ("import_seconds", Json::F64(stats.import_seconds)),
+        ("resolve_seconds", Json::F64(stats.resolve_seconds)),
+    ]);
+
+    for name in module_names {
+        let mut stats = llvm::ThinLTOModuleStats::default();
+        llvm::LLVMRustThinLTOGetModuleStats(data.0, name.as_ptr(), &mut stats);
+        write_report_line(&report, "imports", name.to_str().ok(), vec![
+            ("imported_functions", Json::U64(stats.imported_functions)),
+            ("imported_globals", Json::U64(stats.imported_globals)),
+            ("imported_instructions", Json::U64(stats.imported_instructions)),
+            ("source_modules", Json::U64(stats.source_modules)),
+            ("source_module_bytes", Json::U64(stats.source_module_bytes)),
+            ("exports", Json::U64(stats.exports)),
+            ("exported_instructions", Json::U64(stats.exported_instructions)),
+            ("imported_by", Json::U64(stats.imported_by)),
+        ]);
+    }
+    Ok(report)
+}
+
+fn write_report_line(report: &Mutex<File>,
+                     kind: &str,
+                     module: Option<&str>,
+                     fields: Vec<(&str, Json)>) {
+    let mut obj = BTreeMap::new();
+    obj.insert("kind".to_string(), Json::String(kind.to_string()));
+    if let Some(module) = module {
+        obj.insert("module".to_string(), Json::String(module.to_string()));
+    }
+    for (key, value) in fields {
+        obj.insert(key.to_string(), value);
+    }
+    // The report is purely informational, so don't fail the compilation if
+    // we can't write to it.
+    let mut file = report.lock().unwrap();
+    drop(writeln!(file, "{}", Json::Object(obj)));
+}
+
+fn secs(dur: Duration) -> f64 {
+    dur.as_secs() as f64 + dur.subsec_nanos() as f64 / 1_000_000_000.0
+}
+
+const THIN_LTO_ANALYSIS_FILENAME: &'static str = "thin-lto-analysis.bin";
+
+/// Compares the global ThinLTO analysis with the one saved by the previous
+/// incremental compilation session, returning for each module whether it's
+/// unchanged since then. The current analysis is then saved for the next
+/// session.
+unsafe fn diff_with_previous_session(cgcx: &CodegenContext,
+                                     diag_handler: &Handler,
+                                     data: &ThinData,
+                                     module_names: &[CString],
+                                     incr_comp_session_dir: &Path,
+                                     salt: u64)
+    -> Vec<bool>
+{
+    let path = in_incr_comp_dir(incr_comp_session_dir, THIN_LTO_ANALYSIS_FILENAME);
+    let path_c = path2cstr(&path);
+    let tag = CString::new(format!("{:016x}", salt)).unwrap();
+
+    let mut unchanged = vec![false; module_names.len()];
+    if path.exists() {
+        let previous = llvm::LLVMRustThinLTOReadAnalysis(path_c.as_ptr(), tag.as_ptr());
+        if previous.is_null() {
+            if cgcx.opts.debugging_opts.incremental_info {
+                eprintln!("incremental: ignoring previous thin LTO analysis: {}",
+                          llvm::last_error().unwrap_or(String::new()));
+            }
+        } else {
+            for (unchanged, name) in unchanged.iter_mut().zip(module_names) {
+                *unchanged = llvm::LLVMRustThinLTOModuleUnchanged(data.0,
+                                                                  previous,
+                                                                  name.as_ptr());
+            }
+            llvm::LLVMRustThinLTOFreeAnalysis(previous);
+        }
+    }
+    if cgcx.opts.debugging_opts.incremental_info {
+        eprintln!("incremental: thin LTO: {} of {} modules unchanged",
+                  unchanged.iter().filter(|u| **u).count(),
+                  unchanged.len());
+    }
+
+    if !llvm::LLVMRustThinLTOWriteAnalysis(data.0, path_c.as_ptr(), tag.as_ptr()) {
+        let msg = format!("failed to save thin LTO analysis to {}", path.display());
+        match llvm::last_error() {
+            Some(err) => diag_handler.warn(&format!("{}: {}", msg, err)),
+            None => diag_handler.warn(&msg),
+        }
+    }
+    unchanged
+}
+
+/// Everything besides the LLVM modules themselves which determines the object
+/// file that a ThinLTO module ends up being compiled to.
+pub fn thinlto_cache_salt(cgcx: &CodegenContext) -> u64 {
+    let mut hasher = DefaultHasher::new();
+    option_env!("CFG_VERSION").unwrap_or("unknown version").hash(&mut hasher);
+    cgcx.opts.dep_tracking_hash().hash(&mut hasher);
+    hasher.finish()
+}
+
 fn run_pass_manager(cgcx: &CodegenContext,
                     tm: TargetMachineRef,
                     llmod: ModuleRef,
                     config: &ModuleConfig,
-                    thin: bool) {
+                    thin: bool,
+                    module_name: &str) {
     // Now we have one massive module inside of llmod. Time to run the
     // LTO-specific optimization passes that LLVM provides.
     //
@@ -431,7 +789,8 @@ fn run_pass_manager(cgcx: &CodegenContext,
     //      tools/lto/LTOCodeGenerator.cpp
     debug!("running the pass manager");
     unsafe {
-        let pm = llvm::LLVMCreatePassManager();
+        let timings = write::PassTimings::new(cgcx);
+        let pm = write::create_pass_manager(timings.as_ref());
         llvm::LLVMRustAddAnalysisPasses(tm, pm, llmod);
         let pass = llvm::LLVMRustFindAndCreatePass("verify\0".as_ptr() as *const _);
         assert!(!pass.is_null());
@@ -457,6 +816,11 @@ fn run_pass_manager(cgcx: &CodegenContext,
              llvm::LLVMRunPassManager(pm, llmod));
 
         llvm::LLVMDisposePassManager(pm);
+
+        if let Some(ref timings) = timings {
+            let stage = if thin { "thin-lto" } else { "lto" };
+            timings.save(cgcx, stage, module_name);
+        }
     }
     debug!("lto done");
 }
@@ -464,6 +828,7 @@ fn run_pass_manager(cgcx: &CodegenContext,
 pub enum SerializedModule {
     Local(ModuleBuffer),
     FromRlib(Vec<u8>),
+    FromFile(Vec<u8>),
 }
 
 impl SerializedModule {
@@ -471,23 +836,43 @@ impl SerializedModule {
         match *self {
             SerializedModule::Local(ref m) => m.data(),
             SerializedModule::FromRlib(ref m) => m,
+            SerializedModule::FromFile(ref m) => m,
         }
     }
 }
 
+/// The symbols which are exported from the crate and so can't be internalized,
+/// hashed once for all the lookups of the restriction pass and ThinLTO.
+struct ExportSet(*mut llvm::ExportSet);
+
+impl ExportSet {
+    fn new(symbols: &[CString]) -> ExportSet {
+        let ptrs = symbols.iter().map(|s| s.as_ptr()).collect::<Vec<_>>();
+        ExportSet(unsafe {
+            llvm::LLVMRustExportSetCreate(ptrs.as_ptr(), ptrs.len() as libc::size_t)
+        })
+    }
+}
+
+impl Drop for ExportSet {
+    fn drop(&mut self) {
+        unsafe { llvm::LLVMRustExportSetFree(self.0); }
+    }
+}
+
 pub struct ModuleBuffer(*mut llvm::ModuleBuffer);
 
 unsafe impl Send for ModuleBuffer {}
 unsafe impl Sync for ModuleBuffer {}
 
 impl ModuleBuffer {
-    fn new(m: ModuleRef) -> ModuleBuffer {
+    pub fn new(m: ModuleRef) -> ModuleBuffer {
         ModuleBuffer(unsafe {
             llvm::LLVMRustModuleBufferCreate(m)
         })
     }
 
-    fn data(&self) -> &[u8] {
+    pub fn data(&self) -> &[u8] {
         unsafe {
             let ptr = llvm::LLVMRustModuleBufferPtr(self.0);
             let len = llvm::LLVMRustModuleBufferLen(self.0);
@@ -512,6 +897,18 @@ struct ThinShared {
     thin_buffers: Vec<ThinBuffer>,
     serialized_modules: Vec<SerializedModule>,
     module_names: Vec<CString>,
+    // The identifiers the index knows each module by, indexed like
+    // `module_names`. Empty if that's just their names, as it is for everything
+    // but index shards, which refer to modules by the path of their bitcode.
+    module_ids: Vec<CString>,
+    // Cache keys for each module, indexed like `module_names`. Empty if the
+    // ThinLTO cache isn't in use.
+    cache_keys: Vec<Option<String>>,
+    // Whether each module is unchanged since the previous incremental
+    // session, indexed like `module_names`. Empty if not incremental.
+    unchanged: Vec<bool>,
+    // Destination for `-Z thinlto-report`, shared by all backend threads.
+    report: Option<Mutex<File>>,
 }
 
 struct ThinData(*mut llvm::ThinLTOData);
@@ -555,6 +952,21 @@ impl ThinModule {
         self.shared.module_names[self.idx].to_str().unwrap()
     }
 
+    fn id(&self) -> &CStr {
+        self.shared.module_ids.get(self.idx)
+            .unwrap_or(&self.shared.module_names[self.idx])
+    }
+
+    fn cache_key(&self) -> Option<&str> {
+        self.shared.cache_keys.get(self.idx)
+            .and_then(|key| key.as_ref())
+            .map(|key| &key[..])
+    }
+
+    fn unchanged_since_last_session(&self) -> bool {
+        self.shared.unchanged.get(self.idx).cloned().unwrap_or(false)
+    }
+
     fn cost(&self) -> u64 {
         // Yes, that's correct, we're using the size of the bytecode as an
         // indicator for how costly this codegen unit is.
@@ -587,7 +999,7 @@ impl ThinModule {
             llcx,
             self.data().as_ptr(),
             self.data().len(),
-            self.shared.module_names[self.idx].as_ptr(),
+            self.id().as_ptr(),
         );
         assert!(!llmod.is_null());
         let mtrans = ModuleTranslation {
@@ -618,28 +1030,37 @@ impl ThinModule {
         //
         // You can find some more comments about these functions in the LLVM
         // bindings we've got (currently `PassWrapper.cpp`)
+        let mut steps = Vec::new();
+        let start = Instant::now();
         if !llvm::LLVMRustPrepareThinLTORename(self.shared.data.0, llmod) {
             let msg = format!("failed to prepare thin LTO module");
             return Err(write::llvm_err(&diag_handler, msg))
         }
+        steps.push(("rename_seconds", start.elapsed()));
         cgcx.save_temp_bitcode(&mtrans, "thin-lto-after-rename");
         timeline.record("rename");
+        let start = Instant::now();
         if !llvm::LLVMRustPrepareThinLTOResolveWeak(self.shared.data.0, llmod) {
             let msg = format!("failed to prepare thin LTO module");
             return Err(write::llvm_err(&diag_handler, msg))
         }
+        steps.push(("resolve_weak_seconds", start.elapsed()));
         cgcx.save_temp_bitcode(&mtrans, "thin-lto-after-resolve");
         timeline.record("resolve");
+        let start = Instant::now();
         if !llvm::LLVMRustPrepareThinLTOInternalize(self.shared.data.0, llmod) {
             let msg = format!("failed to prepare thin LTO module");
             return Err(write::llvm_err(&diag_handler, msg))
         }
+        steps.push(("internalize_seconds", start.elapsed()));
         cgcx.save_temp_bitcode(&mtrans, "thin-lto-after-internalize");
         timeline.record("internalize");
+        let start = Instant::now();
         if !llvm::LLVMRustPrepareThinLTOImport(self.shared.data.0, llmod) {
             let msg = format!("failed to prepare thin LTO module");
             return Err(write::llvm_err(&diag_handler, msg))
         }
+        steps.push(("import_seconds", start.elapsed()));
         cgcx.save_temp_bitcode(&mtrans, "thin-lto-after-import");
         timeline.record("import");
 
@@ -650,7 +1071,15 @@ impl ThinModule {
         // little differently.
         info!("running thin lto passes over {}", mtrans.name);
         let config = cgcx.config(mtrans.kind);
-        run_pass_manager(cgcx, tm, llmod, config, true);
+        let start = Instant::now();
+        run_pass_manager(cgcx, tm, llmod, config, true, &mtrans.name);
+        steps.push(("optimize_seconds", start.elapsed()));
+        if let Some(ref report) = self.shared.report {
+            let fields = steps.into_iter()
+                .map(|(step, dur)| (step, Json::F64(secs(dur))))
+                .collect();
+            write_report_line(report, "backend", Some(self.name()), fields);
+        }
         cgcx.save_temp_bitcode(&mtrans, "thin-lto-after-pm");
         timeline.record("thin-done");
         Ok(mtrans)
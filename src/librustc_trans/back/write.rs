@@ -14,6 +14,7 @@ use back::linker::LinkerInfo;
 use back::symbol_export::ExportedSymbols;
 use rustc_incremental::{save_trans_partition, in_incr_comp_dir};
 use rustc::dep_graph::DepGraph;
+use rustc::ich::Fingerprint;
 use rustc::middle::cstore::{LinkMeta, EncodedMetadata};
 use rustc::session::config::{self, OutputFilenames, OutputType, OutputTypes, Passes, SomePasses,
                              AllPasses, Sanitizer};
@@ -37,20 +38,27 @@ use syntax_pos::MultiSpan;
 use syntax_pos::symbol::Symbol;
 use context::{is_pie_binary, get_reloc_model};
 use jobserver::{Client, Acquired};
+use rustc_data_structures::stable_hasher::StableHasher;
 use rustc_demangle;
 
+use std::__rand::{thread_rng, Rng};
 use std::any::Any;
-use std::ffi::CString;
+use std::cmp;
+use std::env;
+use std::ffi::{CStr, CString, OsString};
 use std::fs;
+use std::hash::Hasher;
 use std::io;
-use std::io::Write;
+use std::io::{Read, Write};
 use std::mem;
 use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::ptr;
 use std::str;
 use std::sync::Arc;
 use std::sync::mpsc::{channel, Sender, Receiver};
 use std::slice;
-use std::time::Instant;
+use std::time::{Duration, Instant};
 use std::thread;
 use libc::{c_uint, c_void, c_char, size_t};
 
@@ -99,6 +107,67 @@ pub fn write_output_file(
     }
 }
 
+pub fn write_assembly_and_object(
+        handler: &errors::Handler,
+        target: llvm::TargetMachineRef,
+        pm: llvm::PassManagerRef,
+        m: ModuleRef,
+        asm_output: &Path,
+        obj_output: &Path) -> Result<(), FatalError> {
+    unsafe {
+        let asm_output_c = path2cstr(asm_output);
+        let obj_output_c = path2cstr(obj_output);
+        let result = llvm::LLVMRustWriteAssemblyAndObject(
+                target, pm, m, asm_output_c.as_ptr(), obj_output_c.as_ptr());
+        if result.into_result().is_err() {
+            let msg = format!("could not write output to {} and {}",
+                              asm_output.display(), obj_output.display());
+            Err(llvm_err(handler, msg))
+        } else {
+            Ok(())
+        }
+    }
+}
+
+/// An object file LLVM emitted into memory.
+#[derive(Debug)]
+pub struct ObjectBuffer(*mut llvm::ObjectBuffer);
+
+unsafe impl Send for ObjectBuffer {}
+unsafe impl Sync for ObjectBuffer {}
+
+impl ObjectBuffer {
+    pub fn data(&self) -> &[u8] {
+        unsafe {
+            let ptr = llvm::LLVMRustObjectBufferPtr(self.0);
+            let len = llvm::LLVMRustObjectBufferLen(self.0);
+            slice::from_raw_parts(ptr, len as usize)
+        }
+    }
+}
+
+impl Drop for ObjectBuffer {
+    fn drop(&mut self) {
+        unsafe { llvm::LLVMRustObjectBufferFree(self.0); }
+    }
+}
+
+pub fn write_output_to_buffer(
+        handler: &errors::Handler,
+        target: llvm::TargetMachineRef,
+        pm: llvm::PassManagerRef,
+        m: ModuleRef,
+        file_type: llvm::FileType) -> Result<ObjectBuffer, FatalError> {
+    unsafe {
+        let buffer = llvm::LLVMRustWriteOutputToBuffer(target, pm, m, file_type);
+        if buffer.is_null() {
+            Err(llvm_err(handler, "could not write output to memory".to_string()))
+        } else {
+            Ok(ObjectBuffer(buffer))
+        }
+    }
+}
+
 // On android, we by default compile for armv7 processors. This enables
 // things like double word CAS instructions (rather than emulating them)
 // which are *far* more efficient. This is obviously undesirable in some
@@ -188,9 +257,11 @@ pub fn target_machine_factory(sess: &Session)
     let features = CString::new(target_feature(sess).as_bytes()).unwrap();
     let is_pie_binary = is_pie_binary(sess);
 
+    // Target machines come out of a pool shared by all threads and have to be
+    // handed back with `LLVMRustReturnTargetMachine` once done with.
     Arc::new(move || {
         let tm = unsafe {
-            llvm::LLVMRustCreateTargetMachine(
+            llvm::LLVMRustCheckoutTargetMachine(
                 triple.as_ptr(), cpu.as_ptr(), features.as_ptr(),
                 code_model,
                 reloc_model,
@@ -222,6 +293,11 @@ pub struct ModuleConfig {
     /// Some(level) to optimize binary size, or None to not affect program size.
     opt_size: Option<llvm::CodeGenOptSize>,
 
+    // Instrument the code to generate PGO profile data into this file.
+    pgo_gen: Option<String>,
+    // Optimize using the PGO profile data in this file, unless it's empty.
+    pgo_use: String,
+
     // Flags indicating which outputs to produce.
     emit_no_opt_bc: bool,
     emit_bc: bool,
@@ -238,6 +314,8 @@ pub struct ModuleConfig {
     vectorize_loop: bool,
     vectorize_slp: bool,
     merge_functions: bool,
+    // Keep a copy of the bitcode in the object files, see `embedded_cmdline`.
+    embed_bitcode: bool,
     inline_threshold: Option<usize>,
     // Instead of creating an object file by doing LLVM codegen, just
     // make the object file bitcode. Provides easy compatibility with
@@ -252,6 +330,9 @@ impl ModuleConfig {
             opt_level: None,
             opt_size: None,
 
+            pgo_gen: None,
+            pgo_use: String::new(),
+
             emit_no_opt_bc: false,
             emit_bc: false,
             emit_lto_bc: false,
@@ -267,6 +348,7 @@ impl ModuleConfig {
             vectorize_loop: false,
             vectorize_slp: false,
             merge_functions: false,
+            embed_bitcode: false,
             inline_threshold: None
         }
     }
@@ -292,8 +374,8 @@ impl ModuleConfig {
                             sess.opts.optimize == config::OptLevel::Aggressive &&
                             !sess.target.target.options.is_like_emscripten;
 
-        self.merge_functions = sess.opts.optimize == config::OptLevel::Default ||
-                               sess.opts.optimize == config::OptLevel::Aggressive;
+        self.merge_functions = sess.opts.debugging_opts.merge_functions &&
+                               sess.opts.optimize != config::OptLevel::No;
     }
 }
 
@@ -310,7 +392,7 @@ pub struct CodegenContext {
     pub opts: Arc<config::Options>,
     pub crate_types: Vec<config::CrateType>,
     pub each_linked_rlib_for_lto: Vec<(CrateNum, PathBuf)>,
-    output_filenames: Arc<OutputFilenames>,
+    pub output_filenames: Arc<OutputFilenames>,
     regular_module_config: Arc<ModuleConfig>,
     metadata_module_config: Arc<ModuleConfig>,
     allocator_module_config: Arc<ModuleConfig>,
@@ -329,6 +411,9 @@ pub struct CodegenContext {
     // The incremental compilation session directory, or None if we are not
     // compiling incrementally
     pub incr_comp_session_dir: Option<PathBuf>,
+    // Whether object files of regular modules are kept in memory rather than
+    // written out, as they're only going into archives built by rustc itself
+    pub objects_in_memory: bool,
     // Channel back to the main control thread to send messages to
     coordinator_send: Sender<Box<Any + Send>>,
     // A reference to the TimeGraph so we can register timings. None means that
@@ -449,6 +534,117 @@ unsafe extern "C" fn diagnostic_handler(info: DiagnosticInfoRef, user: *mut c_vo
     }
 }
 
+/// Time spent in each LLVM pass run over a module, collected for
+/// `-Z llvm-pass-timings` and `-Z trans-trace`.
+pub struct PassTimings {
+    raw: *mut llvm::PassTimings,
+    created: Instant,
+    // Where to send individual pass runs when tracing.
+    trace: Option<(TimeGraph, time_graph::TimelineId)>,
+}
+
+// Pass runs shorter than this are left out of traces, there'd be far too many
+// of them otherwise as function passes run once per function.
+const MIN_TRACED_PASS_NANOS: u64 = 50_000;
+
+impl PassTimings {
+    pub fn new(cgcx: &CodegenContext) -> Option<PassTimings> {
+        let trace = if cgcx.opts.debugging_opts.trans_trace {
+            cgcx.time_graph.clone().map(|tg| (tg, time_graph::TimelineId(cgcx.worker)))
+        } else {
+            None
+        };
+        if !cgcx.opts.debugging_opts.llvm_pass_timings && trace.is_none() {
+            return None
+        }
+        let raw = unsafe { llvm::LLVMRustPassTimingsCreate() };
+        if trace.is_some() {
+            unsafe { llvm::LLVMRustPassTimingsRecordEvents(raw, MIN_TRACED_PASS_NANOS); }
+        }
+        Some(PassTimings {
+            raw,
+            created: Instant::now(),
+            trace,
+        })
+    }
+
+    /// Writes the timings collected so far to the JSON file for `stage` of
+    /// the given module, if `-Z llvm-pass-timings` is in use. Failing to do so
+    /// isn't fatal, it's just a warning.
+    pub fn save(&self, cgcx: &CodegenContext, stage: &str, module_name: &str) {
+        if !cgcx.opts.debugging_opts.llvm_pass_timings {
+            return
+        }
+        let json = llvm::build_string(|s| unsafe {
+            llvm::LLVMRustPassTimingsWriteJSON(self.raw, s)
+        }).expect("non-UTF8 LLVM pass name");
+        let ext = format!("{}-pass-timings.json", stage);
+        let path = cgcx.output_filenames.temp_path_ext(&ext, Some(module_name));
+        if let Err(e) = fs::File::create(&path).and_then(|mut f| f.write_all(json.as_bytes())) {
+            cgcx.create_diag_handler()
+                .warn(&format!("failed to write {}: {}", path.display(), e));
+        }
+    }
+
+    unsafe fn traced_spans(&self) -> Vec<time_graph::Span> {
+        let at = |nanos: u64| {
+            self.created + Duration::new(nanos / 1_000_000_000, (nanos % 1_000_000_000) as u32)
+        };
+        (0..llvm::LLVMRustPassTimingsEventCount(self.raw)).map(|i| {
+            let mut function = ptr::null();
+            let mut start = 0;
+            let mut end = 0;
+            let pass = llvm::LLVMRustPassTimingsGetEvent(self.raw, i, &mut function,
+                                                         &mut start, &mut end);
+            let pass = CStr::from_ptr(pass).to_string_lossy();
+            let function = CStr::from_ptr(function).to_string_lossy();
+            let name = if function.is_empty() {
+                pass.into_owned()
+            } else {
+                format!("{} [{}]", pass, function)
+            };
+            time_graph::Span {
+                category: "llvm",
+                name,
+                start: at(start),
+                end: at(end),
+            }
+        }).collect()
+    }
+}
+
+impl Drop for PassTimings {
+    fn drop(&mut self) {
+        unsafe {
+            if let Some((ref tg, timeline)) = self.trace {
+                tg.record_spans(timeline, self.traced_spans());
+            }
+            llvm::LLVMRustPassTimingsFree(self.raw);
+        }
+    }
+}
+
+/// Creates a module pass manager, timing every pass it runs if `timings` is
+/// given.
+pub unsafe fn create_pass_manager(timings: Option<&PassTimings>) -> PassManagerRef {
+    match timings {
+        Some(timings) => llvm::LLVMRustCreateTimedPassManager(timings.raw),
+        None => llvm::LLVMCreatePassManager(),
+    }
+}
+
+unsafe fn create_function_pass_manager(llmod: ModuleRef,
+                                       timings: Option<&PassTimings>)
+    -> PassManagerRef
+{
+    match timings {
+        Some(timings) => {
+            llvm::LLVMRustCreateTimedFunctionPassManagerForModule(llmod, timings.raw)
+        }
+        None => llvm::LLVMCreateFunctionPassManagerForModule(llmod),
+    }
+}
+
 // Unsafe due to LLVM calls.
 unsafe fn optimize(cgcx: &CodegenContext,
                    diag_handler: &Handler,
@@ -475,13 +671,20 @@ unsafe fn optimize(cgcx: &CodegenContext,
         llvm::LLVMWriteBitcodeToFile(llmod, out.as_ptr());
     }
 
+    // Functions with `#[target_clones]` are cloned before anything else runs
+    // so each clone gets optimized for its own set of features.
+    if !llvm::LLVMRustExpandTargetClones(llmod, tm) {
+        return Err(llvm_err(diag_handler, "failed to multiversion functions".to_string()))
+    }
+
     if config.opt_level.is_some() {
         // Create the two optimizing pass managers. These mirror what clang
         // does, and are by populated by LLVM's default PassManagerBuilder.
         // Each manager has a different set of passes, but they also share
         // some common passes.
-        let fpm = llvm::LLVMCreateFunctionPassManagerForModule(llmod);
-        let mpm = llvm::LLVMCreatePassManager();
+        let timings = PassTimings::new(cgcx);
+        let fpm = create_function_pass_manager(llmod, timings.as_ref());
+        let mpm = create_pass_manager(timings.as_ref());
 
         // If we're verifying or linting, add them to the function pass
         // manager.
@@ -503,14 +706,25 @@ unsafe fn optimize(cgcx: &CodegenContext,
             true
         };
 
+        // With `-Z new-llvm-pass-manager` the default pipeline is built and
+        // run by LLVM's new pass manager in between the two legacy ones, which
+        // are then only left with the passes we add explicitly.
+        // PGO is only wired up for the legacy pass manager's pipeline though.
+        let new_pm_pipeline = !config.no_prepopulate_passes &&
+                              cgcx.opts.debugging_opts.new_llvm_pass_manager &&
+                              config.pgo_gen.is_none() &&
+                              config.pgo_use.is_empty();
+
         if !config.no_verify { assert!(addpass("verify")); }
         if !config.no_prepopulate_passes {
             llvm::LLVMRustAddAnalysisPasses(tm, fpm, llmod);
             llvm::LLVMRustAddAnalysisPasses(tm, mpm, llmod);
-            with_llvm_pmb(llmod, &config, &mut |b| {
-                llvm::LLVMPassManagerBuilderPopulateFunctionPassManager(b, fpm);
-                llvm::LLVMPassManagerBuilderPopulateModulePassManager(b, mpm);
-            })
+            if !new_pm_pipeline {
+                with_llvm_pmb(llmod, &config, &mut |b| {
+                    llvm::LLVMPassManagerBuilderPopulateFunctionPassManager(b, fpm);
+                    llvm::LLVMPassManagerBuilderPopulateModulePassManager(b, mpm);
+                })
+            }
         }
 
         for pass in &config.passes {
@@ -534,18 +748,55 @@ unsafe fn optimize(cgcx: &CodegenContext,
         time(config.time_passes, &format!("llvm function passes [{}]", module_name.unwrap()), ||
              llvm::LLVMRustRunFunctionPassManager(fpm, llmod));
         timeline.record("fpm");
+        if new_pm_pipeline {
+            let opt_level = new_pm_opt_level(config);
+            let debug_logging = cgcx.opts.debugging_opts.print_llvm_passes;
+            let ok = time(config.time_passes,
+                          &format!("llvm new pass manager [{}]", module_name.unwrap()),
+                          || llvm::LLVMRustRunNewPassManagerPipeline(llmod,
+                                                                     tm,
+                                                                     opt_level,
+                                                                     config.no_builtins,
+                                                                     debug_logging));
+            if !ok {
+                return Err(llvm_err(diag_handler, "failed to run new pass manager".to_string()))
+            }
+            timeline.record("new-pm");
+        }
         time(config.time_passes, &format!("llvm module passes [{}]", module_name.unwrap()), ||
              llvm::LLVMRunPassManager(mpm, llmod));
 
         // Deallocate managers that we're now done with
         llvm::LLVMDisposePassManager(fpm);
         llvm::LLVMDisposePassManager(mpm);
+
+        if let Some(ref timings) = timings {
+            timings.save(cgcx, "opt", module_name.unwrap());
+        }
     }
     Ok(())
 }
 
+/// The level of the new pass manager's default pipeline which matches the
+/// `PassManagerBuilder` configuration `with_llvm_pmb` would use.
+fn new_pm_opt_level(config: &ModuleConfig) -> llvm::PassBuilderOptLevel {
+    match config.opt_size.unwrap_or(llvm::CodeGenOptSizeNone) {
+        llvm::CodeGenOptSizeDefault => return llvm::PassBuilderOptLevel::Os,
+        llvm::CodeGenOptSizeAggressive => return llvm::PassBuilderOptLevel::Oz,
+        llvm::CodeGenOptSizeNone => {}
+    }
+    match config.opt_level.unwrap_or(llvm::CodeGenOptLevel::None) {
+        llvm::CodeGenOptLevel::None => llvm::PassBuilderOptLevel::O0,
+        llvm::CodeGenOptLevel::Less => llvm::PassBuilderOptLevel::O1,
+        llvm::CodeGenOptLevel::Default => llvm::PassBuilderOptLevel::O2,
+        llvm::CodeGenOptLevel::Aggressive => llvm::PassBuilderOptLevel::O3,
+        llvm::CodeGenOptLevel::Other => bug!("CodeGenOptLevel::Other selected"),
+    }
+}
+
 fn generate_lto_work(cgcx: &CodegenContext,
-                     modules: Vec<ModuleTranslation>)
+                     modules: Vec<ModuleTranslation>,
+                     threads: usize)
     -> Vec<(WorkItem, u64)>
 {
     let mut timeline = cgcx.time_graph.as_ref().map(|tg| {
@@ -558,7 +809,7 @@ fn generate_lto_work(cgcx: &CodegenContext,
     } else {
         lto::LTOMode::JustThisCrate
     };
-    let lto_modules = lto::run(cgcx, modules, mode, &mut timeline)
+    let lto_modules = lto::run(cgcx, modules, mode, threads, &mut timeline)
         .unwrap_or_else(|e| panic!(e));
 
     lto_modules.into_iter().map(|module| {
@@ -584,6 +835,7 @@ unsafe fn codegen(cgcx: &CodegenContext,
     let module_name = mtrans.name.clone();
     let module_name = Some(&module_name[..]);
     let handlers = DiagnosticHandlers::new(cgcx, diag_handler, llcx);
+    let timings = PassTimings::new(cgcx);
 
     // A codegen-specific pass manager is used to generate object
     // files for an LLVM module.
@@ -596,10 +848,11 @@ unsafe fn codegen(cgcx: &CodegenContext,
     unsafe fn with_codegen<F, R>(tm: TargetMachineRef,
                                  llmod: ModuleRef,
                                  no_builtins: bool,
+                                 timings: Option<&PassTimings>,
                                  f: F) -> R
         where F: FnOnce(PassManagerRef) -> R,
     {
-        let cpm = llvm::LLVMCreatePassManager();
+        let cpm = create_pass_manager(timings);
         llvm::LLVMRustAddAnalysisPasses(tm, cpm, llmod);
         llvm::LLVMRustAddLibraryInfo(cpm, llmod, no_builtins);
         f(cpm)
@@ -616,11 +869,18 @@ unsafe fn codegen(cgcx: &CodegenContext,
 
     let bc_out = cgcx.output_filenames.temp_path(OutputType::Bitcode, module_name);
     let obj_out = cgcx.output_filenames.temp_path(OutputType::Object, module_name);
+    let mut object_data = None;
+
+    if config.merge_functions {
+        let folded = llvm::LLVMRustMergeIdenticalFunctions(llmod);
+        debug!("folded {} identical functions in {}", folded, module_name.unwrap());
+        timeline.record("merge-functions");
+    }
 
     if write_bc {
         let bc_out_c = path2cstr(&bc_out);
         if llvm::LLVMRustThinLTOAvailable() {
-            with_codegen(tm, llmod, config.no_builtins, |cpm| {
+            with_codegen(tm, llmod, config.no_builtins, timings.as_ref(), |cpm| {
                 llvm::LLVMRustWriteThinBitcodeToFile(
                     cpm,
                     llmod,
@@ -633,6 +893,16 @@ unsafe fn codegen(cgcx: &CodegenContext,
         timeline.record("bc");
     }
 
+    if config.embed_bitcode && (write_obj || config.emit_asm) {
+        let cmdline = embedded_cmdline(&cgcx.opts);
+        if !llvm::LLVMRustEmbedBitcode(llmod,
+                                       cmdline.as_ptr() as *const c_char,
+                                       cmdline.len() as size_t) {
+            return Err(llvm_err(diag_handler, "failed to embed bitcode".to_string()))
+        }
+        timeline.record("embed-bc");
+    }
+
     time(config.time_passes, &format!("codegen passes [{}]", module_name.unwrap()),
          || -> Result<(), FatalError> {
         if config.emit_ir {
@@ -670,14 +940,30 @@ unsafe fn codegen(cgcx: &CodegenContext,
                 cursor.position() as size_t
             }
 
-            with_codegen(tm, llmod, config.no_builtins, |cpm| {
+            with_codegen(tm, llmod, config.no_builtins, timings.as_ref(), |cpm| {
                 llvm::LLVMRustPrintModule(cpm, llmod, out.as_ptr(), demangle_callback);
                 llvm::LLVMDisposePassManager(cpm);
             });
             timeline.record("ir");
         }
 
-        if config.emit_asm {
+        // With `-Z assemble-emitted-asm`, if the object is going into a file
+        // anyway we can get the assembly listing out of the same codegen run,
+        // as long as the target is able to assemble its own output. This goes
+        // through the target's MC assembler, so the object isn't guaranteed to
+        // be byte-for-byte what direct object emission would produce.
+        let in_memory = write_obj && cgcx.objects_in_memory && mtrans.kind == ModuleKind::Regular;
+        let asm_and_obj = cgcx.opts.debugging_opts.assemble_emitted_asm &&
+                          config.emit_asm && write_obj && !in_memory &&
+                          llvm::LLVMRustTargetHasAsmParser(tm);
+
+        if asm_and_obj {
+            let path = cgcx.output_filenames.temp_path(OutputType::Assembly, module_name);
+            with_codegen(tm, llmod, config.no_builtins, timings.as_ref(), |cpm| {
+                write_assembly_and_object(diag_handler, tm, cpm, llmod, &path, &obj_out)
+            })?;
+            timeline.record("asm+obj");
+        } else if config.emit_asm {
             let path = cgcx.output_filenames.temp_path(OutputType::Assembly, module_name);
 
             // We can't use the same module for asm and binary output, because that triggers
@@ -688,7 +974,7 @@ unsafe fn codegen(cgcx: &CodegenContext,
             } else {
                 llmod
             };
-            with_codegen(tm, llmod, config.no_builtins, |cpm| {
+            with_codegen(tm, llmod, config.no_builtins, timings.as_ref(), |cpm| {
                 write_output_file(diag_handler, tm, cpm, llmod, &path,
                                   llvm::FileType::AssemblyFile)
             })?;
@@ -698,8 +984,13 @@ unsafe fn codegen(cgcx: &CodegenContext,
             timeline.record("asm");
         }
 
-        if write_obj {
-            with_codegen(tm, llmod, config.no_builtins, |cpm| {
+        if in_memory {
+            object_data = Some(with_codegen(tm, llmod, config.no_builtins, timings.as_ref(), |cpm| {
+                write_output_to_buffer(diag_handler, tm, cpm, llmod, llvm::FileType::ObjectFile)
+            })?);
+            timeline.record("obj");
+        } else if write_obj && !asm_and_obj {
+            with_codegen(tm, llmod, config.no_builtins, timings.as_ref(), |cpm| {
                 write_output_file(diag_handler, tm, cpm, llmod, &obj_out,
                                   llvm::FileType::ObjectFile)
             })?;
@@ -709,6 +1000,10 @@ unsafe fn codegen(cgcx: &CodegenContext,
         Ok(())
     })?;
 
+    if let Some(ref timings) = timings {
+        timings.save(cgcx, "codegen", module_name.unwrap());
+    }
+
     if copy_bc_to_obj {
         debug!("copying bitcode {:?} to obj {:?}", bc_out, obj_out);
         if let Err(e) = link_or_copy(&bc_out, &obj_out) {
@@ -724,9 +1019,11 @@ unsafe fn codegen(cgcx: &CodegenContext,
     }
 
     drop(handlers);
-    Ok(mtrans.into_compiled_module(config.emit_obj,
-                                   config.emit_bc,
-                                   &cgcx.output_filenames))
+    let mut module = mtrans.into_compiled_module(config.emit_obj,
+                                                 config.emit_bc,
+                                                 &cgcx.output_filenames);
+    module.object_data = object_data.map(Arc::new);
+    Ok(module)
 }
 
 pub struct CompiledModules {
@@ -735,40 +1032,70 @@ pub struct CompiledModules {
     pub allocator_module: Option<CompiledModule>,
 }
 
+/// The options stored next to embedded bitcode, NUL-separated like clang does.
+/// The bitcode is already optimized, so these are just the ones needed to
+/// generate the same machine code from it again.
+fn embedded_cmdline(opts: &config::Options) -> Vec<u8> {
+    let mut args = Vec::new();
+    if let Some(ref cpu) = opts.cg.target_cpu {
+        args.push(format!("-Ctarget-cpu={}", cpu));
+    }
+    if !opts.cg.target_feature.is_empty() {
+        args.push(format!("-Ctarget-feature={}", opts.cg.target_feature));
+    }
+    if let Some(ref model) = opts.cg.relocation_model {
+        args.push(format!("-Crelocation-model={}", model));
+    }
+    if let Some(ref model) = opts.cg.code_model {
+        args.push(format!("-Ccode-model={}", model));
+    }
+    let mut cmdline = Vec::new();
+    for arg in args {
+        cmdline.extend_from_slice(arg.as_bytes());
+        cmdline.push(0);
+    }
+    cmdline
+}
+
+/// Whether object files can be kept in memory, which is only the case if all
+/// we'll do with them is put them into rlibs and static libraries and nothing
+/// else wants to find them on disk: no linker, no `--emit obj`, no
+/// `-C save-temps`, no caches for incremental compilation or ThinLTO, and no
+/// ThinLTO backends running in separate processes.
+fn objects_can_stay_in_memory(sess: &Session) -> bool {
+    let archives_only = sess.crate_types.borrow().iter().all(|&crate_type| {
+        crate_type == config::CrateTypeRlib || crate_type == config::CrateTypeStaticlib
+    });
+    // Archive members can only be created from memory on LLVM 3.9 and later.
+    let llvm_supported = unsafe {
+        let major = llvm::LLVMRustVersionMajor();
+        major > 3 || (major == 3 && llvm::LLVMRustVersionMinor() >= 9)
+    };
+    archives_only &&
+        llvm_supported &&
+        !sess.opts.output_types.contains_key(&OutputType::Object) &&
+        !sess.opts.cg.save_temps &&
+        sess.opts.incremental.is_none() &&
+        sess.opts.debugging_opts.thinlto_cache_dir.is_none() &&
+        !sess.opts.debugging_opts.thinlto_emit_index
+}
+
 fn need_crate_bitcode_for_rlib(sess: &Session) -> bool {
     sess.crate_types.borrow().contains(&config::CrateTypeRlib) &&
     sess.opts.output_types.contains_key(&OutputType::Exe)
 }
 
-pub fn start_async_translation(tcx: TyCtxt,
-                               time_graph: Option<TimeGraph>,
-                               link: LinkMeta,
-                               metadata: EncodedMetadata,
-                               coordinator_receive: Receiver<Box<Any + Send>>,
-                               total_cgus: usize)
-                               -> OngoingCrateTranslation {
-    let sess = tcx.sess;
-    let crate_output = tcx.output_filenames(LOCAL_CRATE);
-    let crate_name = tcx.crate_name(LOCAL_CRATE);
-    let no_builtins = attr::contains_name(&tcx.hir.krate().attrs, "no_builtins");
-    let subsystem = attr::first_attr_value_str_by_name(&tcx.hir.krate().attrs,
-                                                       "windows_subsystem");
-    let windows_subsystem = subsystem.map(|subsystem| {
-        if subsystem != "windows" && subsystem != "console" {
-            tcx.sess.fatal(&format!("invalid windows subsystem `{}`, only \
-                                     `windows` and `console` are allowed",
-                                    subsystem));
-        }
-        subsystem.to_string()
-    });
-
-    let no_integrated_as = tcx.sess.opts.cg.no_integrated_as ||
-        (tcx.sess.target.target.options.no_integrated_as &&
-         (crate_output.outputs.contains_key(&OutputType::Object) ||
-          crate_output.outputs.contains_key(&OutputType::Exe)));
-    let linker_info = LinkerInfo::new(tcx);
-    let crate_info = CrateInfo::new(tcx);
+fn no_integrated_as(sess: &Session, outputs: &OutputFilenames) -> bool {
+    sess.opts.cg.no_integrated_as ||
+        (sess.target.target.options.no_integrated_as &&
+         (outputs.outputs.contains_key(&OutputType::Object) ||
+          outputs.outputs.contains_key(&OutputType::Exe)))
+}
 
+/// The configurations of regular, metadata and allocator modules.
+fn module_configs(sess: &Session, no_builtins: bool, no_integrated_as: bool)
+    -> (ModuleConfig, ModuleConfig, ModuleConfig)
+{
     let output_types_override = if no_integrated_as {
         OutputTypes::new(&[(OutputType::Assembly, None)])
     } else {
@@ -800,6 +1127,10 @@ pub fn start_async_translation(tcx: TyCtxt,
         modules_config.passes.push("insert-gcov-profiling".to_owned())
     }
 
+    modules_config.pgo_gen = sess.opts.debugging_opts.pgo_gen.clone();
+    modules_config.pgo_use = sess.opts.debugging_opts.pgo_use.clone();
+    modules_config.embed_bitcode = sess.opts.debugging_opts.embed_bitcode;
+
     modules_config.opt_level = Some(get_llvm_opt_level(sess.opts.optimize));
     modules_config.opt_size = Some(get_llvm_opt_size(sess.opts.optimize));
 
@@ -854,6 +1185,37 @@ pub fn start_async_translation(tcx: TyCtxt,
     metadata_config.time_passes = false;
     allocator_config.time_passes = false;
 
+    (modules_config, metadata_config, allocator_config)
+}
+
+pub fn start_async_translation(tcx: TyCtxt,
+                               time_graph: Option<TimeGraph>,
+                               link: LinkMeta,
+                               metadata: EncodedMetadata,
+                               coordinator_receive: Receiver<Box<Any + Send>>,
+                               total_cgus: usize)
+                               -> OngoingCrateTranslation {
+    let sess = tcx.sess;
+    let crate_output = tcx.output_filenames(LOCAL_CRATE);
+    let crate_name = tcx.crate_name(LOCAL_CRATE);
+    let no_builtins = attr::contains_name(&tcx.hir.krate().attrs, "no_builtins");
+    let subsystem = attr::first_attr_value_str_by_name(&tcx.hir.krate().attrs,
+                                                       "windows_subsystem");
+    let windows_subsystem = subsystem.map(|subsystem| {
+        if subsystem != "windows" && subsystem != "console" {
+            tcx.sess.fatal(&format!("invalid windows subsystem `{}`, only \
+                                     `windows` and `console` are allowed",
+                                    subsystem));
+        }
+        subsystem.to_string()
+    });
+
+    let no_integrated_as = no_integrated_as(sess, &crate_output);
+    let linker_info = LinkerInfo::new(tcx);
+    let crate_info = CrateInfo::new(tcx);
+    let (modules_config, metadata_config, allocator_config) =
+        module_configs(sess, no_builtins, no_integrated_as);
+
     let client = sess.jobserver_from_env.clone().unwrap_or_else(|| {
         // Pick a "reasonable maximum" if we don't otherwise have a jobserver in
         // our environment, capping out at 32 so we don't take everything down
@@ -1114,6 +1476,277 @@ enum WorkItemResult {
     NeedsLTO(ModuleTranslation),
 }
 
+/// Whether the object file of a module may be reused from a previous
+/// compilation.
+///
+/// Only object files are reused, so if any other output of the module was
+/// requested (or intermediate bitcode is being saved) then the module is
+/// always optimized and translated from scratch.
+fn object_reusable(cgcx: &CodegenContext, config: &ModuleConfig) -> bool {
+    config.emit_obj &&
+        !config.obj_is_bitcode &&
+        !config.emit_bc &&
+        !config.emit_ir &&
+        !config.emit_asm &&
+        !cgcx.save_temps
+}
+
+/// Returns where the object file for an LTO module with the given cache key
+/// is stored in the ThinLTO cache, or `None` if the module can't be cached.
+fn thinlto_cache_path(cgcx: &CodegenContext,
+                      config: &ModuleConfig,
+                      key: Option<&str>) -> Option<PathBuf> {
+    let dir = match cgcx.opts.debugging_opts.thinlto_cache_dir {
+        Some(ref dir) => dir,
+        None => return None,
+    };
+    let key = match key {
+        Some(key) => key,
+        None => return None,
+    };
+    if !object_reusable(cgcx, config) {
+        return None
+    }
+    Some(Path::new(dir).join(format!("{}.o", key)))
+}
+
+/// Returns where the object file for an LTO module is saved in the incremental
+/// compilation session directory, for reuse by the next session.
+fn thinlto_incr_path(cgcx: &CodegenContext,
+                     config: &ModuleConfig,
+                     name: &str) -> Option<PathBuf> {
+    let dir = match cgcx.incr_comp_session_dir {
+        Some(ref dir) => dir,
+        None => return None,
+    };
+    if !object_reusable(cgcx, config) {
+        return None
+    }
+    Some(in_incr_comp_dir(dir, &format!("{}.thin-lto.o", name)))
+}
+
+/// Returns where the object file of a module that isn't going through LTO is
+/// saved in the incremental compilation session directory, along with the
+/// file holding the hash of the unoptimized LLVM IR it was compiled from.
+///
+/// The dependency graph decides whether a codegen unit needs to be translated
+/// again, but quite often the LLVM IR that comes out is exactly what the
+/// previous session optimized, for example if a change only affected code
+/// that was inlined elsewhere or type-checking. With
+/// `-Z reuse-unchanged-ir-objects` those modules reuse the object file from
+/// last time instead of being optimized and translated again. This works on
+/// whole codegen units, a single changed function means the unit is compiled
+/// again.
+fn ir_reuse_paths(cgcx: &CodegenContext,
+                  config: &ModuleConfig,
+                  name: &str) -> Option<(PathBuf, PathBuf)> {
+    if !cgcx.opts.debugging_opts.reuse_unchanged_ir_objects {
+        return None
+    }
+    let dir = match cgcx.incr_comp_session_dir {
+        Some(ref dir) => dir,
+        None => return None,
+    };
+    if !object_reusable(cgcx, config) {
+        return None
+    }
+    Some((in_incr_comp_dir(dir, &format!("{}.unchanged-ir.o", name)),
+          in_incr_comp_dir(dir, &format!("{}.ir-hash", name))))
+}
+
+/// Hashes the LLVM IR of a module along with everything else that affects the
+/// object file it's compiled to.
+fn module_ir_hash(cgcx: &CodegenContext, llmod: ModuleRef) -> String {
+    let buffer = lto::ModuleBuffer::new(llmod);
+    let mut hasher = StableHasher::<Fingerprint>::new();
+    hasher.write_u64(lto::thinlto_cache_salt(cgcx));
+    hasher.write(buffer.data());
+    let hash: Fingerprint = hasher.finish();
+    hash.to_hex()
+}
+
+fn load_reusable_object(cgcx: &CodegenContext,
+                           config: &ModuleConfig,
+                           cache_path: &Path,
+                           name: String) -> Option<CompiledModule> {
+    let object = cgcx.output_filenames.temp_path(OutputType::Object, Some(&name));
+    if let Err(e) = link_or_copy(cache_path, &object) {
+        debug!("can't reuse {:?} for `{}`: {}", cache_path, name, e);
+        return None
+    }
+    info!("reusing {:?} for `{}`", cache_path, name);
+    Some(CompiledModule {
+        object,
+        llmod_id: name.clone(),
+        name,
+        kind: ModuleKind::Regular,
+        pre_existing: false,
+        emit_bc: config.emit_bc,
+        emit_obj: config.emit_obj,
+        object_data: None,
+    })
+}
+
+/// A path next to `path` for writing a file before it's renamed to `path`.
+/// Other compilations may be writing the same file at the same time, so the
+/// name is unique to this one.
+fn unique_tmp_path(path: &Path) -> PathBuf {
+    let mut rng = thread_rng();
+    let mut name = path.file_name().map(|n| n.to_os_string()).unwrap_or_default();
+    name.push(format!(".{:08x}{:08x}.tmp", rng.next_u32(), rng.next_u32()));
+    path.with_file_name(name)
+}
+
+fn save_reusable_object(diag_handler: &Handler, object: &Path, cache_path: &Path) {
+    // Other compilations may be reading from the ThinLTO cache at the same
+    // time, so first put the object in place under a temporary name and then
+    // rename it into its final location.
+    let result = cache_path.parent().map_or(Ok(()), fs::create_dir_all).and_then(|()| {
+        let tmp = unique_tmp_path(cache_path);
+        if let Err(e) = link_or_copy(object, &tmp).and_then(|_| fs::rename(&tmp, cache_path)) {
+            let _ = fs::remove_file(&tmp);
+            return Err(e)
+        }
+        Ok(())
+    });
+    if let Err(e) = result {
+        diag_handler.warn(&format!("failed to save {} for reuse as {}: {}",
+                                   object.display(),
+                                   cache_path.display(),
+                                   e));
+    }
+}
+
+/// Runs the ThinLTO backend for the module `name` in a separate rustc process,
+/// from the files `-Z thinlto-emit-index` wrote for it. The process only ever
+/// holds that module and what it imports, and if LLVM crashes on it only that
+/// process goes down.
+///
+/// The backend is given the same command line as this compilation, so it's
+/// configured the same way, plus the job to run instead of compiling.
+fn run_backend_process(cgcx: &CodegenContext,
+                       diag_handler: &Handler,
+                       config: &ModuleConfig,
+                       name: String)
+    -> Result<CompiledModule, FatalError>
+{
+    let outputs = &cgcx.output_filenames;
+    let job = lto::BackendJob {
+        name: name.clone(),
+        out_directory: outputs.out_directory.clone(),
+        out_filestem: outputs.out_filestem.clone(),
+        single_output_file: outputs.single_output_file.clone(),
+        extra: outputs.extra.clone(),
+        no_builtins: config.no_builtins,
+        emit_bc: config.emit_bc,
+        plugin_passes: cgcx.plugin_passes.clone(),
+        total_cgus: cgcx.total_cgus,
+    };
+    let job_path = outputs.temp_path_ext("thinlto-job.json", Some(&name));
+    if let Err(e) = job.write(&job_path) {
+        let msg = format!("failed to write {}: {}", job_path.display(), e);
+        return Err(diag_handler.fatal(&msg))
+    }
+
+    let mut job_arg = OsString::from("-Zthinlto-backend-job=");
+    job_arg.push(&job_path);
+    let status = env::current_exe().and_then(|rustc| {
+        Command::new(rustc)
+            .args(env::args_os().skip(1))
+            .arg(job_arg)
+            .stdin(Stdio::null())
+            .status()
+    });
+    match status {
+        Ok(ref status) if status.success() => {}
+        Ok(status) => {
+            let msg = format!("ThinLTO backend process for `{}` failed: {}", name, status);
+            return Err(diag_handler.fatal(&msg))
+        }
+        Err(e) => {
+            let msg = format!("failed to run ThinLTO backend process for `{}`: {}", name, e);
+            return Err(diag_handler.fatal(&msg))
+        }
+    }
+
+    Ok(CompiledModule {
+        object: outputs.temp_path(OutputType::Object, Some(&name)),
+        llmod_id: name.clone(),
+        name,
+        kind: ModuleKind::Regular,
+        pre_existing: false,
+        emit_bc: config.emit_bc,
+        emit_obj: config.emit_obj,
+        object_data: None,
+    })
+}
+
+/// Runs the ThinLTO backend job that `run_backend_process` wrote to `path`,
+/// optimizing and generating code for one module from its index shard. This is
+/// all a rustc started with `-Z thinlto-backend-job` does.
+pub fn run_thinlto_backend_job(sess: &Session, path: &Path) {
+    let job = match lto::BackendJob::read(path) {
+        Ok(job) => job,
+        Err(e) => sess.fatal(&format!("failed to read ThinLTO backend job {}: {}",
+                                      path.display(),
+                                      e)),
+    };
+    let output_filenames = OutputFilenames {
+        out_directory: job.out_directory.clone(),
+        out_filestem: job.out_filestem.clone(),
+        single_output_file: job.single_output_file.clone(),
+        extra: job.extra.clone(),
+        outputs: sess.opts.output_types.clone(),
+    };
+    let no_integrated_as = no_integrated_as(sess, &output_filenames);
+    let (mut modules_config, metadata_config, allocator_config) =
+        module_configs(sess, job.no_builtins, no_integrated_as);
+    // Whether bitcode is emitted depends on the crate types, which aren't
+    // known here as the crate isn't parsed.
+    modules_config.emit_bc = job.emit_bc;
+
+    let (shared_emitter, shared_emitter_main) = SharedEmitter::new();
+    let (coordinator_send, _coordinator_receive) = channel();
+    let cgcx = CodegenContext {
+        crate_types: Vec::new(),
+        each_linked_rlib_for_lto: Vec::new(),
+        lto: sess.lto(),
+        thinlto: sess.opts.debugging_opts.thinlto,
+        no_landing_pads: sess.no_landing_pads(),
+        save_temps: sess.opts.cg.save_temps,
+        opts: Arc::new(sess.opts.clone()),
+        time_passes: sess.time_passes(),
+        exported_symbols: Arc::new(FxHashMap()),
+        plugin_passes: job.plugin_passes.clone(),
+        remark: sess.opts.cg.remark.clone(),
+        worker: 0,
+        incr_comp_session_dir: None,
+        objects_in_memory: false,
+        coordinator_send,
+        diag_emitter: shared_emitter,
+        time_graph: None,
+        output_filenames: Arc::new(output_filenames),
+        regular_module_config: Arc::new(modules_config),
+        metadata_module_config: Arc::new(metadata_config),
+        allocator_module_config: Arc::new(allocator_config),
+        tm_factory: target_machine_factory(sess),
+        total_cgus: job.total_cgus,
+    };
+
+    let diag_handler = cgcx.create_diag_handler();
+    let config = cgcx.config(ModuleKind::Regular);
+    let mut timeline = Timeline::noop();
+    let result = lto::thin_lto_from_index_shard(&cgcx, &diag_handler, &job.name)
+        .and_then(|mut lto| unsafe {
+            let module = lto.optimize(&cgcx, &mut timeline)?;
+            codegen(&cgcx, &diag_handler, module, config, &mut timeline)
+        });
+    shared_emitter_main.check(sess, false);
+    if let Err(e) = result {
+        panic!(e)
+    }
+}
+
 fn execute_work_item(cgcx: &CodegenContext,
                      work_item: WorkItem,
                      timeline: &mut Timeline)
@@ -1124,11 +1757,50 @@ fn execute_work_item(cgcx: &CodegenContext,
     let mtrans = match work_item {
         WorkItem::Optimize(mtrans) => mtrans,
         WorkItem::LTO(mut lto) => {
-            unsafe {
-                let module = lto.optimize(cgcx, timeline)?;
-                let module = codegen(cgcx, &diag_handler, module, config, timeline)?;
-                return Ok(WorkItemResult::Compiled(module))
+            let name = lto.name().to_string();
+            let cache_path = thinlto_cache_path(cgcx, config, lto.cache_key());
+            let incr_path = thinlto_incr_path(cgcx, config, &name);
+
+            // Objects from the previous incremental session are only valid if
+            // the ThinLTO analysis says nothing changed, whereas everything
+            // relevant is already part of the key of cached objects.
+            let previous_session = if lto.unchanged_since_last_session() {
+                incr_path.as_ref()
+            } else {
+                None
+            };
+            for path in previous_session.into_iter().chain(cache_path.as_ref()) {
+                let reused = load_reusable_object(cgcx, config, path, name.clone());
+                if let Some(module) = reused {
+                    timeline.record("thin-lto-reused");
+                    if let Some(ref incr_path) = incr_path {
+                        if path != incr_path {
+                            save_reusable_object(&diag_handler, &module.object, incr_path);
+                        }
+                    }
+                    return Ok(WorkItemResult::Compiled(module))
+                }
+            }
+            let out_of_process = match lto {
+                lto::LtoModuleTranslation::Thin(_) => {
+                    cgcx.opts.debugging_opts.thinlto_emit_index
+                }
+                lto::LtoModuleTranslation::Fat { .. } => false,
+            };
+            let module = if out_of_process {
+                let module = run_backend_process(cgcx, &diag_handler, config, name)?;
+                timeline.record("thin-lto-process");
+                module
+            } else {
+                unsafe {
+                    let module = lto.optimize(cgcx, timeline)?;
+                    codegen(cgcx, &diag_handler, module, config, timeline)?
+                }
+            };
+            for path in cache_path.iter().chain(incr_path.iter()) {
+                save_reusable_object(&diag_handler, &module.object, path);
             }
+            return Ok(WorkItemResult::Compiled(module))
         }
     };
     let module_name = mtrans.name.clone();
@@ -1171,36 +1843,75 @@ fn execute_work_item(cgcx: &CodegenContext,
             pre_existing: true,
             emit_bc: config.emit_bc,
             emit_obj: config.emit_obj,
+            object_data: None,
         }))
     } else {
+        let lto = cgcx.lto;
+
+        let auto_thin_lto =
+            cgcx.thinlto &&
+            cgcx.total_cgus > 1 &&
+            mtrans.kind != ModuleKind::Allocator;
+
+        // If we're a metadata module we never participate in LTO.
+        //
+        // If LTO was explicitly requested on the command line, we always
+        // LTO everything else.
+        //
+        // If LTO *wasn't* explicitly requested and we're not a metdata
+        // module, then we may automatically do ThinLTO if we've got
+        // multiple codegen units. Note, however, that the allocator module
+        // doesn't participate here automatically because of linker
+        // shenanigans later on.
+        let needs_lto = mtrans.kind != ModuleKind::Metadata && (lto || auto_thin_lto);
+
+        let ir_reuse = if needs_lto || mtrans.kind != ModuleKind::Regular {
+            None
+        } else {
+            ir_reuse_paths(cgcx, config, &module_name).map(|(object, hash_file)| {
+                let hash = module_ir_hash(cgcx, mtrans.llvm().unwrap().llmod);
+                (object, hash_file, hash)
+            })
+        };
+        if let Some((ref object, ref hash_file, ref hash)) = ir_reuse {
+            let unchanged = fs::File::open(hash_file).and_then(|mut f| {
+                let mut previous = String::new();
+                f.read_to_string(&mut previous)?;
+                Ok(previous == *hash)
+            }).unwrap_or(false);
+            if unchanged {
+                let reused = load_reusable_object(cgcx, config, object, module_name.clone());
+                if let Some(module) = reused {
+                    if cgcx.opts.debugging_opts.incremental_info {
+                        eprintln!("incremental: reusing object of `{}` as its LLVM IR \
+                                   is unchanged", module_name);
+                    }
+                    timeline.record("unchanged-ir");
+                    return Ok(WorkItemResult::Compiled(module))
+                }
+            }
+        }
+
         debug!("llvm-optimizing {:?}", module_name);
 
         unsafe {
             optimize(cgcx, &diag_handler, &mtrans, config, timeline)?;
 
-            let lto = cgcx.lto;
-
-            let auto_thin_lto =
-                cgcx.thinlto &&
-                cgcx.total_cgus > 1 &&
-                mtrans.kind != ModuleKind::Allocator;
-
-            // If we're a metadata module we never participate in LTO.
-            //
-            // If LTO was explicitly requested on the command line, we always
-            // LTO everything else.
-            //
-            // If LTO *wasn't* explicitly requested and we're not a metdata
-            // module, then we may automatically do ThinLTO if we've got
-            // multiple codegen units. Note, however, that the allocator module
-            // doesn't participate here automatically because of linker
-            // shenanigans later on.
-            if mtrans.kind == ModuleKind::Metadata || (!lto && !auto_thin_lto) {
-                let module = codegen(cgcx, &diag_handler, mtrans, config, timeline)?;
-                Ok(WorkItemResult::Compiled(module))
-            } else {
-                Ok(WorkItemResult::NeedsLTO(mtrans))
+            if needs_lto {
+                return Ok(WorkItemResult::NeedsLTO(mtrans))
             }
+            let module = codegen(cgcx, &diag_handler, mtrans, config, timeline)?;
+            if let Some((object, hash_file, hash)) = ir_reuse {
+                // The hash is only written once the object is in place, so
+                // that a failure in between can't pair it with a stale object.
+                let _ = fs::remove_file(&hash_file);
+                save_reusable_object(&diag_handler, &module.object, &object);
+                if let Err(e) = fs::File::create(&hash_file)
+                                         .and_then(|mut f| f.write_all(hash.as_bytes())) {
+                    diag_handler.warn(&format!("failed to save {}: {}", hash_file.display(), e));
+                }
+            }
+            Ok(WorkItemResult::Compiled(module))
         }
     }
 }
@@ -1280,6 +1991,9 @@ fn start_executing_work(tcx: TyCtxt,
         each_linked_rlib_for_lto.push((cnum, path.to_path_buf()));
     }));
 
+    let objects_in_memory = sess.opts.debugging_opts.objects_in_memory &&
+                            objects_can_stay_in_memory(sess);
+
     let cgcx = CodegenContext {
         crate_types: sess.crate_types.borrow().clone(),
         each_linked_rlib_for_lto,
@@ -1294,6 +2008,7 @@ fn start_executing_work(tcx: TyCtxt,
         remark: sess.opts.cg.remark.clone(),
         worker: 0,
         incr_comp_session_dir: sess.incr_comp_session_dir_opt().map(|r| r.clone()),
+        objects_in_memory,
         coordinator_send,
         diag_emitter: shared_emitter.clone(),
         time_graph,
@@ -1528,7 +2243,9 @@ fn start_executing_work(tcx: TyCtxt,
                     assert!(needs_lto.len() > 0);
                     started_lto = true;
                     let modules = mem::replace(&mut needs_lto, Vec::new());
-                    for (work, cost) in generate_lto_work(&cgcx, modules) {
+                    // The implicit token plus the ones kept for LTO below.
+                    let threads = cmp::min(tokens.len() + 1, max_workers);
+                    for (work, cost) in generate_lto_work(&cgcx, modules, threads) {
                         let insertion_index = work_items
                             .binary_search_by_key(&cost, |&(_, cost)| cost)
                             .unwrap_or_else(|e| e);
@@ -1590,8 +2307,28 @@ fn start_executing_work(tcx: TyCtxt,
                 running += 1;
             }
 
-            // Relinquish accidentally acquired extra tokens
-            tokens.truncate(running);
+            // Relinquish accidentally acquired extra tokens. Once everything
+            // is translated, the tokens of modules waiting for LTO are kept
+            // though, so the parallel parts of LTO can make use of them.
+            let keep = if translation_done && !started_lto {
+                cmp::max(running, needs_lto.len())
+            } else {
+                running
+            };
+            tokens.truncate(keep);
+
+            // Sample the state of the queue whenever we're about to wait, so a
+            // trace shows both when work was queued up but we were waiting
+            // for jobserver tokens, and when workers were starved.
+            if cgcx.opts.debugging_opts.trans_trace {
+                if let Some(ref tg) = cgcx.time_graph {
+                    tg.record_counters("llvm work items", &[
+                        ("queued", work_items.len() as u64),
+                        ("running", running as u64),
+                        ("tokens", tokens.len() as u64),
+                    ]);
+                }
+            }
 
             let msg = coordinator_receive.recv().unwrap();
             match *msg.downcast::<Message>().ok().unwrap() {
@@ -1855,10 +2592,21 @@ pub unsafe fn with_llvm_pmb(llmod: ModuleRef,
     let opt_size = config.opt_size.unwrap_or(llvm::CodeGenOptSizeNone);
     let inline_threshold = config.inline_threshold;
 
+    let pgo_gen_path = config.pgo_gen.as_ref().map(|s| CString::new(s.as_bytes()).unwrap());
+    let pgo_use_path = if config.pgo_use.is_empty() {
+        None
+    } else {
+        Some(CString::new(config.pgo_use.as_bytes()).unwrap())
+    };
+
     llvm::LLVMRustConfigurePassManagerBuilder(builder, opt_level,
                                               config.merge_functions,
                                               config.vectorize_slp,
-                                              config.vectorize_loop);
+                                              config.vectorize_loop,
+                                              pgo_gen_path.as_ref().map_or(ptr::null(),
+                                                                           |s| s.as_ptr()),
+                                              pgo_use_path.as_ref().map_or(ptr::null(),
+                                                                           |s| s.as_ptr()));
     llvm::LLVMPassManagerBuilderSetSizeLevel(builder, opt_size as u32);
 
     if opt_size != llvm::CodeGenOptSizeNone {
@@ -2039,7 +2787,12 @@ impl OngoingCrateTranslation {
         sess.abort_if_errors();
 
         if let Some(time_graph) = self.time_graph {
-            time_graph.dump(&format!("{}-timings", self.crate_name));
+            if sess.opts.debugging_opts.trans_time_graph {
+                time_graph.dump(&format!("{}-timings", self.crate_name));
+            }
+            if sess.opts.debugging_opts.trans_trace {
+                time_graph.dump_trace(&format!("{}-trace", self.crate_name));
+            }
         }
 
         copy_module_artifacts_into_incr_comp_cache(sess,
@@ -2126,6 +2879,25 @@ impl OngoingCrateTranslation {
     }
 }
 
+/// Estimates how much work it'll be for LLVM to optimize and generate code for
+/// `llmod`, in arbitrary units.
+///
+/// This is a heuristic: the instruction count dominates, call sites are
+/// weighted up as they're what the inliner works on, and deeply nested loops
+/// scale everything up as they're where most of the loop and vectorization
+/// passes spend their time. The estimated bitcode size accounts for the
+/// globals and declarations that have to be written out no matter how little
+/// code there is, like large constant tables.
+pub fn llvm_module_cost(llmod: ModuleRef) -> u64 {
+    let mut cost = llvm::ModuleCostBreakdown::default();
+    unsafe {
+        llvm::LLVMRustModuleCost(llmod, &mut cost);
+    }
+    let base = cost.instructions + cost.basic_blocks + 4 * cost.call_sites +
+               cost.bitcode_size / 64;
+    base * (4 + cmp::min(cost.max_loop_depth, 4)) / 4
+}
+
 pub fn submit_translated_module_to_llvm(tcx: TyCtxt,
                                         mtrans: ModuleTranslation,
                                         cost: u64) {
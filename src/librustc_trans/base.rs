@@ -916,7 +916,8 @@ pub fn trans_crate<'a, 'tcx>(tcx: TyCtxt<'a, 'tcx, 'tcx>,
         kind: ModuleKind::Metadata,
     };
 
-    let time_graph = if tcx.sess.opts.debugging_opts.trans_time_graph {
+    let time_graph = if tcx.sess.opts.debugging_opts.trans_time_graph ||
+                        tcx.sess.opts.debugging_opts.trans_trace {
         Some(time_graph::TimeGraph::new())
     } else {
         None
@@ -1351,10 +1352,20 @@ fn compile_codegen_unit<'a, 'tcx>(tcx: TyCtxt<'a, 'tcx, 'tcx>,
     let (stats, module) = module_translation(tcx, cgu);
     let time_to_translate = start_time.elapsed();
 
-    // We assume that the cost to run LLVM on a CGU is proportional to
-    // the time we needed for translating it.
-    let cost = time_to_translate.as_secs() * 1_000_000_000 +
-               time_to_translate.subsec_nanos() as u64;
+    // By default we assume that the cost to run LLVM on a CGU is proportional
+    // to the time we needed for translating it, which is free to measure.
+    // Otherwise look at the IR we've generated, which is more accurate for
+    // CGUs whose translation time doesn't reflect how much LLVM will have to
+    // chew on, e.g. those with a few huge functions.
+    let cost = match module.llvm() {
+        Some(llvm) if tcx.sess.opts.debugging_opts.schedule_by_llvm_cost => {
+            write::llvm_module_cost(llvm.llmod)
+        }
+        _ => {
+            time_to_translate.as_secs() * 1_000_000_000 +
+                time_to_translate.subsec_nanos() as u64
+        }
+    };
 
     write::submit_translated_module_to_llvm(tcx,
                                             module,
@@ -18,7 +18,7 @@ use common::*;
 use machine::llalign_of_pref;
 use type_::Type;
 use value::Value;
-use libc::{c_uint, c_char};
+use libc::{c_uint, c_char, size_t};
 use rustc::ty::TyCtxt;
 use rustc::session::Session;
 
@@ -908,6 +908,32 @@ impl<'a, 'tcx> Builder<'a, 'tcx> {
         }
     }
 
+    /// Like `call`, but the call is created with `attrs` and `cconv` already
+    /// set, rather than having them applied to it afterwards.
+    pub fn call_with_attrs(&self, llfn: ValueRef, args: &[ValueRef],
+                           bundle: Option<&OperandBundleDef>,
+                           attrs: &[llvm::AttributeEntry],
+                           cconv: llvm::CallConv) -> ValueRef {
+        self.count_insn("call");
+
+        debug!("Call {:?} with args ({})",
+               Value(llfn),
+               args.iter()
+                   .map(|&v| format!("{:?}", Value(v)))
+                   .collect::<Vec<String>>()
+                   .join(", "));
+
+        let args = self.check_call("call", llfn, args);
+        let bundle = bundle.as_ref().map(|b| b.raw()).unwrap_or(ptr::null_mut());
+
+        unsafe {
+            llvm::LLVMRustBuildCallWithAttributes(self.llbuilder, llfn, args.as_ptr(),
+                                                  args.len() as c_uint, bundle,
+                                                  attrs.as_ptr(), attrs.len() as size_t,
+                                                  cconv as c_uint, noname())
+        }
+    }
+
     pub fn select(&self, cond: ValueRef, then_val: ValueRef, else_val: ValueRef) -> ValueRef {
         self.count_insn("select");
         unsafe {
@@ -186,7 +186,7 @@ pub unsafe fn create_context_and_module(sess: &Session, mod_name: &str) -> (Cont
     if sess.target.target.options.is_builtin {
         let tm = ::back::write::create_target_machine(sess);
         llvm::LLVMRustSetDataLayoutFromTargetMachine(llmod, tm);
-        llvm::LLVMRustDisposeTargetMachine(tm);
+        llvm::LLVMRustReturnTargetMachine(tm);
 
         let data_layout = llvm::LLVMGetDataLayout(llmod);
         let data_layout = str::from_utf8(CStr::from_ptr(data_layout).to_bytes())
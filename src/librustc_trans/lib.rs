@@ -26,6 +26,7 @@
 #![feature(i128_type)]
 #![feature(libc)]
 #![feature(quote)]
+#![feature(rand)]
 #![feature(rustc_diagnostic_macros)]
 #![feature(slice_patterns)]
 #![feature(conservative_impl_trait)]
@@ -60,17 +61,20 @@ extern crate num_cpus;
 extern crate syntax_pos;
 extern crate rustc_errors as errors;
 extern crate serialize;
+extern crate serialize as rustc_serialize; // used by deriving
 #[cfg(windows)]
 extern crate cc; // Used to locate MSVC
 
 pub use base::trans_crate;
 
 pub use metadata::LlvmMetadataLoader;
+pub use back::write::run_thinlto_backend_job;
 pub use llvm_util::{init, target_features, print_version, print_passes, print, enable_llvm_debug};
 
 use std::any::Any;
 use std::path::PathBuf;
 use std::rc::Rc;
+use std::sync::Arc;
 use std::sync::mpsc;
 
 use rustc::dep_graph::DepGraph;
@@ -241,6 +245,7 @@ impl ModuleTranslation {
             emit_obj,
             emit_bc,
             object,
+            object_data: None,
         }
     }
 }
@@ -254,6 +259,9 @@ pub struct CompiledModule {
     pub pre_existing: bool,
     pub emit_obj: bool,
     pub emit_bc: bool,
+    /// The contents of `object`, if it was kept in memory instead of being
+    /// written out.
+    pub object_data: Option<Arc<back::write::ObjectBuffer>>,
 }
 
 pub enum ModuleSource {
@@ -279,7 +287,7 @@ impl Drop for ModuleLlvm {
         unsafe {
             llvm::LLVMDisposeModule(self.llmod);
             llvm::LLVMContextDispose(self.llcx);
-            llvm::LLVMRustDisposeTargetMachine(self.tm);
+            llvm::LLVMRustReturnTargetMachine(self.tm);
         }
     }
 }
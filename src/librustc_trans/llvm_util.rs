@@ -19,6 +19,10 @@ use std::ffi::CString;
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::Once;
 
+/// Prepares LLVM for a compilation session. This may be called again for every
+/// session if one process runs several of them: passes and targets are only
+/// registered once per process, whereas the LLVM options of each session are
+/// applied anew.
 pub fn init(sess: &Session) {
     unsafe {
         // Before we touch LLVM, make sure that multithreading is enabled.
@@ -31,12 +35,20 @@ pub fn init(sess: &Session) {
                 POISONED.store(true, Ordering::SeqCst);
             }
 
-            configure_llvm(sess);
+            llvm::LLVMInitializePasses();
+
+            llvm::initialize_available_targets();
         });
 
         if POISONED.load(Ordering::SeqCst) {
             bug!("couldn't enable multi-threaded LLVM");
         }
+
+        // Don't let an error left over from a previous session on this thread
+        // be mistaken for one of ours.
+        let _ = llvm::last_error();
+
+        configure_llvm(sess);
     }
 }
 
@@ -59,10 +71,6 @@ unsafe fn configure_llvm(sess: &Session) {
         }
     }
 
-    llvm::LLVMInitializePasses();
-
-    llvm::initialize_available_targets();
-
     llvm::LLVMRustSetLLVMOptions(llvm_args.len() as c_int,
                                  llvm_args.as_ptr());
 }
@@ -103,6 +111,7 @@ pub fn target_features(sess: &Session) -> Vec<Symbol> {
             features.push(Symbol::intern(&feat[..feat.len() - 1]));
         }
     }
+    unsafe { llvm::LLVMRustReturnTargetMachine(target_machine); }
     features
 }
 
@@ -125,6 +134,7 @@ pub fn print(req: PrintRequest, sess: &Session) {
             PrintRequest::TargetFeatures => llvm::LLVMRustPrintTargetFeatures(tm),
             _ => bug!("rustc_trans can't handle print request: {:?}", req),
         }
+        llvm::LLVMRustReturnTargetMachine(tm);
     }
 }
 
@@ -146,15 +146,20 @@ impl<'a, 'tcx> MirContext<'a, 'tcx> {
                     this.store_return(&ret_bcx, ret_dest, &fn_ty.ret, op);
                 }
             } else {
-                let llret = bcx.call(fn_ptr, &llargs, cleanup_bundle);
-                fn_ty.apply_attrs_callsite(llret);
+                let mut attrs = fn_ty.attribute_entries();
                 if this.mir[bb].is_cleanup {
                     // Cleanup is always the cold path. Don't inline
                     // drop glue. Also, when there is a deeply-nested
                     // struct, there are "symmetry" issues that cause
                     // exponential inlining - see issue #41696.
-                    llvm::Attribute::NoInline.apply_callsite(llvm::AttributePlace::Function, llret);
+                    attrs.push(llvm::AttributeEntry {
+                        index: llvm::AttributePlace::Function.as_uint(),
+                        kind: llvm::Attribute::NoInline,
+                        value: 0,
+                    });
                 }
+                let llret = bcx.call_with_attrs(fn_ptr, &llargs, cleanup_bundle,
+                                                &attrs, fn_ty.cconv);
 
                 if let Some((ret_dest, ret_ty, target)) = destination {
                     let op = OperandRef {
@@ -8,7 +8,8 @@
 // option. This file may not be copied, modified, or distributed
 // except according to those terms.
 
-use std::collections::HashMap;
+use serialize::json::Json;
+use std::collections::{BTreeMap, HashMap};
 use std::fs::File;
 use std::io::prelude::*;
 use std::marker::PhantomData;
@@ -29,6 +30,23 @@ struct Timing {
     events: Vec<(String, Instant)>,
 }
 
+/// Something that happened on a timeline within a work package, as recorded
+/// from outside of trans, e.g. a single LLVM pass run.
+#[derive(Clone)]
+pub struct Span {
+    pub category: &'static str,
+    pub name: String,
+    pub start: Instant,
+    pub end: Instant,
+}
+
+#[derive(Clone)]
+struct Counters {
+    name: &'static str,
+    at: Instant,
+    values: Vec<(&'static str, u64)>,
+}
+
 #[derive(Clone, Copy, Hash, Eq, PartialEq, Debug)]
 pub struct TimelineId(pub usize);
 
@@ -36,11 +54,13 @@ pub struct TimelineId(pub usize);
 struct PerThread {
     timings: Vec<Timing>,
     open_work_package: Option<(Instant, WorkPackageKind, String)>,
+    spans: Vec<Span>,
 }
 
 #[derive(Clone)]
 pub struct TimeGraph {
     data: Arc<Mutex<HashMap<TimelineId, PerThread>>>,
+    counters: Arc<Mutex<Vec<Counters>>>,
 }
 
 #[derive(Clone, Copy)]
@@ -68,7 +88,8 @@ impl Drop for RaiiToken {
 impl TimeGraph {
     pub fn new() -> TimeGraph {
         TimeGraph {
-            data: Arc::new(Mutex::new(HashMap::new()))
+            data: Arc::new(Mutex::new(HashMap::new())),
+            counters: Arc::new(Mutex::new(Vec::new())),
         }
     }
 
@@ -82,6 +103,7 @@ impl TimeGraph {
             let data = table.entry(timeline).or_insert(PerThread {
                 timings: Vec::new(),
                 open_work_package: None,
+                spans: Vec::new(),
             });
 
             assert!(data.open_work_package.is_none());
@@ -117,6 +139,25 @@ impl TimeGraph {
         }
     }
 
+    /// Adds spans that happened within a work package on the given timeline.
+    /// They only show up in the Chrome trace output.
+    pub fn record_spans(&self, timeline: TimelineId, spans: Vec<Span>) {
+        let mut table = self.data.lock().unwrap();
+        if let Some(data) = table.get_mut(&timeline) {
+            data.spans.extend(spans);
+        }
+    }
+
+    /// Records a sample of a group of counters, like how many work items are
+    /// queued or running. They only show up in the Chrome trace output.
+    pub fn record_counters(&self, name: &'static str, values: &[(&'static str, u64)]) {
+        self.counters.lock().unwrap().push(Counters {
+            name,
+            at: Instant::now(),
+            values: values.to_vec(),
+        });
+    }
+
     pub fn dump(&self, output_filename: &str) {
         let table = self.data.lock().unwrap();
 
@@ -245,6 +286,112 @@ impl TimeGraph {
             </html>
         ").unwrap();
     }
+
+    /// Writes everything recorded in the Chrome trace-event format, which can
+    /// be loaded into `chrome://tracing` and similar viewers.
+    ///
+    /// Every timeline becomes a thread there. Work packages are split into
+    /// phases at the events recorded on their timeline, and spans recorded
+    /// within them nest below.
+    pub fn dump_trace(&self, output_filename: &str) {
+        let table = self.data.lock().unwrap();
+        let counters = self.counters.lock().unwrap();
+
+        let earliest_instant = table.values()
+            .flat_map(|data| data.timings.iter().map(|timing| timing.start))
+            .chain(counters.iter().map(|counter| counter.at))
+            .min()
+            .unwrap();
+        let ts = |at: Instant| Json::F64(distance(earliest_instant, at) as f64 / 1000.0);
+        let dur = |start: Instant, end: Instant| {
+            Json::F64(distance(start, end) as f64 / 1000.0)
+        };
+
+        let mut events = Vec::new();
+
+        for (timeline, data) in table.iter() {
+            let tid = Json::U64(timeline.0 as u64);
+            let mut args = BTreeMap::new();
+            args.insert("name".to_string(), Json::String(thread_name(*timeline)));
+            events.push(trace_event(vec![
+                ("name", Json::String("thread_name".to_string())),
+                ("ph", Json::String("M".to_string())),
+                ("tid", tid.clone()),
+                ("args", Json::Object(args)),
+            ]));
+
+            for timing in &data.timings {
+                events.push(trace_event(vec![
+                    ("name", Json::String(timing.name.clone())),
+                    ("cat", Json::String("work".to_string())),
+                    ("ph", Json::String("X".to_string())),
+                    ("tid", tid.clone()),
+                    ("ts", ts(timing.start)),
+                    ("dur", dur(timing.start, timing.end)),
+                ]));
+                let mut phase_start = timing.start;
+                for &(ref name, at) in &timing.events {
+                    events.push(trace_event(vec![
+                        ("name", Json::String(name.clone())),
+                        ("cat", Json::String("phase".to_string())),
+                        ("ph", Json::String("X".to_string())),
+                        ("tid", tid.clone()),
+                        ("ts", ts(phase_start)),
+                        ("dur", dur(phase_start, at)),
+                    ]));
+                    phase_start = at;
+                }
+            }
+
+            for span in &data.spans {
+                events.push(trace_event(vec![
+                    ("name", Json::String(span.name.clone())),
+                    ("cat", Json::String(span.category.to_string())),
+                    ("ph", Json::String("X".to_string())),
+                    ("tid", tid.clone()),
+                    ("ts", ts(span.start)),
+                    ("dur", dur(span.start, span.end)),
+                ]));
+            }
+        }
+
+        for counter in counters.iter() {
+            let args = counter.values.iter()
+                .map(|&(name, value)| (name.to_string(), Json::U64(value)))
+                .collect();
+            events.push(trace_event(vec![
+                ("name", Json::String(counter.name.to_string())),
+                ("ph", Json::String("C".to_string())),
+                ("ts", ts(counter.at)),
+                ("args", Json::Object(args)),
+            ]));
+        }
+
+        let mut file = File::create(format!("{}.json", output_filename)).unwrap();
+        writeln!(file, "{{\"traceEvents\": [").unwrap();
+        for (i, event) in events.iter().enumerate() {
+            let sep = if i + 1 < events.len() { "," } else { "" };
+            writeln!(file, "{}{}", event, sep).unwrap();
+        }
+        writeln!(file, "], \"displayTimeUnit\": \"ms\"}}").unwrap();
+    }
+}
+
+fn trace_event(fields: Vec<(&str, Json)>) -> Json {
+    let mut obj = BTreeMap::new();
+    obj.insert("pid".to_string(), Json::U64(0));
+    for (key, value) in fields {
+        obj.insert(key.to_string(), value);
+    }
+    Json::Object(obj)
+}
+
+fn thread_name(timeline: TimelineId) -> String {
+    if timeline == ::back::write::TRANS_WORKER_TIMELINE {
+        "translation".to_string()
+    } else {
+        format!("LLVM worker {}", timeline.0)
+    }
 }
 
 impl Timeline {
@@ -817,6 +817,10 @@ pub const BUILTIN_ATTRIBUTES: &'static [(&'static str, AttributeType, AttributeG
         Stability::Unstable, "target_feature",
         "the `#[target_feature]` attribute is an experimental feature",
         cfg_fn!(target_feature))),
+    ("target_clones", Whitelisted, Gated(
+        Stability::Unstable, "target_feature",
+        "the `#[target_clones]` attribute is an experimental feature",
+        cfg_fn!(target_feature))),
     ("export_name", Whitelisted, Ungated),
     ("inline", Whitelisted, Ungated),
     ("link", Whitelisted, Ungated),
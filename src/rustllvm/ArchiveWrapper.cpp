@@ -20,10 +20,12 @@ using namespace llvm::object;
 struct RustArchiveMember {
   const char *Filename;
   const char *Name;
+  const char *Data;
+  size_t DataLen;
   Archive::Child Child;
 
   RustArchiveMember()
-      : Filename(nullptr), Name(nullptr),
+      : Filename(nullptr), Name(nullptr), Data(nullptr), DataLen(0),
 #if LLVM_VERSION_GE(3, 8)
         Child(nullptr, nullptr, nullptr)
 #else
@@ -230,6 +232,18 @@ LLVMRustArchiveMemberNew(char *Filename, char *Name,
   return Member;
 }
 
+// Creates a member whose contents are `Data`, which is borrowed until the
+// archive is written.
+extern "C" LLVMRustArchiveMemberRef
+LLVMRustArchiveMemberNewFromBuffer(const char *Name, const char *Data,
+                                   size_t Len) {
+  RustArchiveMember *Member = new RustArchiveMember;
+  Member->Name = Name;
+  Member->Data = Data;
+  Member->DataLen = Len;
+  return Member;
+}
+
 extern "C" void LLVMRustArchiveMemberFree(LLVMRustArchiveMemberRef Member) {
   delete Member;
 }
@@ -249,7 +263,17 @@ LLVMRustWriteArchive(char *Dst, size_t NumMembers,
   for (size_t I = 0; I < NumMembers; I++) {
     auto Member = NewMembers[I];
     assert(Member->Name);
-    if (Member->Filename) {
+    if (Member->Data) {
+#if LLVM_VERSION_GE(3, 9)
+      MemoryBufferRef Buf(StringRef(Member->Data, Member->DataLen),
+                          Member->Name);
+      Members.push_back(NewArchiveMember(Buf));
+#else
+      LLVMRustSetLastError("in-memory archive members are not supported "
+                           "on this LLVM version");
+      return LLVMRustResult::Failure;
+#endif
+    } else if (Member->Filename) {
 #if LLVM_VERSION_GE(3, 9)
       Expected<NewArchiveMember> MOrErr =
           NewArchiveMember::getFile(Member->Filename, true);
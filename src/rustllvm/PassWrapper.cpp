@@ -10,27 +10,57 @@
 
 #include <stdio.h>
 
+#include <chrono>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "rustllvm.h"
 
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/AutoUpgrade.h"
 #include "llvm/IR/AssemblyAnnotationWriter.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/Support/CBindingWrapping.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #if LLVM_VERSION_GE(4, 0)
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Object/ModuleSummaryIndexObjectFile.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Transforms/IPO/AlwaysInliner.h"
 #include "llvm/Transforms/IPO/FunctionImport.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
 #include "llvm/LTO/LTO.h"
+#include "llvm/MC/MCAsmBackend.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/MC/MCObjectFileInfo.h"
+#include "llvm/MC/MCParser/MCAsmParser.h"
+#include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCRegisterInfo.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCSubtargetInfo.h"
 #endif
 
 #include "llvm-c/Transforms/PassManagerBuilder.h"
@@ -106,6 +136,240 @@ extern "C" void LLVMRustAddPass(LLVMPassManagerRef PMR, LLVMPassRef RustPass) {
   PMB->add(Pass);
 }
 
+// Wall-clock time spent in each pass run by a pass manager, aggregated by
+// pass name in the order passes were first added. One of these is created per
+// module and pass manager run so that `-Z llvm-pass-timings` can attribute
+// time to codegen units, unlike LLVM's global `-time-passes` timers.
+//
+// Note that analyses a pass requires are scheduled right before the pass
+// itself, so their time is included in that of the pass requiring them.
+struct LLVMRustPassTimings {
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::string Name;
+    PassKind Kind;
+    double Seconds;
+    uint64_t Runs;
+    Clock::time_point Start;
+  };
+  std::vector<Entry> Entries;
+  StringMap<size_t> Slots;
+
+  // Individual pass runs, only recorded for tracing. Function passes run once
+  // per function, so to keep traces manageable only runs taking at least
+  // `MinEventNanos` are kept.
+  struct Event {
+    size_t Slot;
+    uint64_t StartNanos;
+    uint64_t EndNanos;
+    std::string Function;
+  };
+  Clock::time_point Epoch = Clock::now();
+  bool RecordEvents = false;
+  uint64_t MinEventNanos = 0;
+  std::vector<Event> Events;
+
+  size_t getSlot(StringRef Name, PassKind Kind) {
+    auto It = Slots.insert(std::make_pair(Name, Entries.size()));
+    if (It.second)
+      Entries.push_back(Entry{Name.str(), Kind, 0.0, 0, {}});
+    return It.first->second;
+  }
+
+  void start(size_t Slot) {
+    Entries[Slot].Start = Clock::now();
+  }
+
+  void stop(size_t Slot, StringRef Function) {
+    Entry &E = Entries[Slot];
+    Clock::time_point End = Clock::now();
+    std::chrono::duration<double> Elapsed = End - E.Start;
+    E.Seconds += Elapsed.count();
+    E.Runs++;
+
+    if (!RecordEvents)
+      return;
+    uint64_t StartNanos = nanosSinceEpoch(E.Start);
+    uint64_t EndNanos = nanosSinceEpoch(End);
+    if (EndNanos - StartNanos >= MinEventNanos)
+      Events.push_back(Event{Slot, StartNanos, EndNanos, Function.str()});
+  }
+
+  uint64_t nanosSinceEpoch(Clock::time_point T) const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(T - Epoch)
+        .count();
+  }
+};
+
+namespace {
+
+// Marker passes bracketing a timed pass. They preserve everything so they
+// don't perturb the pipeline, and have the same kind as the pass they bracket
+// so that they're scheduled into the same nested pass manager.
+template <bool IsStart>
+struct FunctionTimingMarker : public FunctionPass {
+  static char ID;
+  LLVMRustPassTimings *Timings;
+  size_t Slot;
+
+  FunctionTimingMarker(LLVMRustPassTimings *Timings, size_t Slot)
+      : FunctionPass(ID), Timings(Timings), Slot(Slot) {}
+
+  bool runOnFunction(Function &F) override {
+    if (IsStart)
+      Timings->start(Slot);
+    else
+      Timings->stop(Slot, F.getName());
+    return false;
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+};
+
+template <bool IsStart>
+struct ModuleTimingMarker : public ModulePass {
+  static char ID;
+  LLVMRustPassTimings *Timings;
+  size_t Slot;
+
+  ModuleTimingMarker(LLVMRustPassTimings *Timings, size_t Slot)
+      : ModulePass(ID), Timings(Timings), Slot(Slot) {}
+
+  bool runOnModule(Module &) override {
+    if (IsStart)
+      Timings->start(Slot);
+    else
+      Timings->stop(Slot, StringRef());
+    return false;
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+};
+
+template <bool IsStart> char FunctionTimingMarker<IsStart>::ID = 0;
+template <bool IsStart> char ModuleTimingMarker<IsStart>::ID = 0;
+
+// A pass manager which brackets every function and module pass added to it
+// with timing markers, including those added by `PassManagerBuilder` and the
+// target's codegen pipeline. Loop and call graph SCC passes are left alone as
+// a marker in between two of them would split up their shared pass manager,
+// so their time shows up in whatever contains them.
+template <typename PassManagerT>
+class TimedPassManager : public PassManagerT {
+  LLVMRustPassTimings *Timings;
+
+public:
+  template <typename... ArgsT>
+  TimedPassManager(LLVMRustPassTimings *Timings, ArgsT &&... Args)
+      : PassManagerT(std::forward<ArgsT>(Args)...), Timings(Timings) {}
+
+  void add(Pass *P) override {
+    PassKind Kind = P->getPassKind();
+    if ((Kind != PT_Function && Kind != PT_Module) || P->getAsImmutablePass()) {
+      PassManagerT::add(P);
+      return;
+    }
+    size_t Slot = Timings->getSlot(P->getPassName(), Kind);
+    if (Kind == PT_Function) {
+      PassManagerT::add(new FunctionTimingMarker<true>(Timings, Slot));
+      PassManagerT::add(P);
+      PassManagerT::add(new FunctionTimingMarker<false>(Timings, Slot));
+    } else {
+      PassManagerT::add(new ModuleTimingMarker<true>(Timings, Slot));
+      PassManagerT::add(P);
+      PassManagerT::add(new ModuleTimingMarker<false>(Timings, Slot));
+    }
+  }
+};
+
+} // namespace
+
+extern "C" LLVMRustPassTimings *LLVMRustPassTimingsCreate() {
+  return new LLVMRustPassTimings();
+}
+
+extern "C" void LLVMRustPassTimingsFree(LLVMRustPassTimings *Timings) {
+  delete Timings;
+}
+
+// Starts recording individual pass runs taking at least `MinNanos`, with
+// timestamps relative to when the timings were created.
+extern "C" void LLVMRustPassTimingsRecordEvents(LLVMRustPassTimings *Timings,
+                                                uint64_t MinNanos) {
+  Timings->RecordEvents = true;
+  Timings->MinEventNanos = MinNanos;
+}
+
+extern "C" size_t
+LLVMRustPassTimingsEventCount(const LLVMRustPassTimings *Timings) {
+  return Timings->Events.size();
+}
+
+// Returns the name of the pass of the `Index`th recorded run, and the
+// function it ran over through `Function`, which is empty for module passes.
+// Both strings live as long as `Timings`.
+extern "C" const char *
+LLVMRustPassTimingsGetEvent(const LLVMRustPassTimings *Timings, size_t Index,
+                            const char **Function, uint64_t *StartNanos,
+                            uint64_t *EndNanos) {
+  const LLVMRustPassTimings::Event &E = Timings->Events[Index];
+  *Function = E.Function.c_str();
+  *StartNanos = E.StartNanos;
+  *EndNanos = E.EndNanos;
+  return Timings->Entries[E.Slot].Name.c_str();
+}
+
+extern "C" LLVMPassManagerRef
+LLVMRustCreateTimedPassManager(LLVMRustPassTimings *Timings) {
+  return wrap(new TimedPassManager<legacy::PassManager>(Timings));
+}
+
+extern "C" LLVMPassManagerRef
+LLVMRustCreateTimedFunctionPassManagerForModule(LLVMModuleRef M,
+                                                LLVMRustPassTimings *Timings) {
+  return wrap(
+      new TimedPassManager<legacy::FunctionPassManager>(Timings, unwrap(M)));
+}
+
+static void writeJSONString(raw_ostream &OS, StringRef Str) {
+  OS << '"';
+  for (unsigned char C : Str) {
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (C < 0x20)
+      OS << format("\\u%04x", C);
+    else
+      OS << C;
+  }
+  OS << '"';
+}
+
+// Writes the timings out as a JSON array of objects, one per pass, in the
+// order the passes were first added.
+extern "C" void
+LLVMRustPassTimingsWriteJSON(const LLVMRustPassTimings *Timings,
+                             RustStringRef Str) {
+  RawRustStringOstream OS(Str);
+  OS << "[";
+  bool First = true;
+  for (const LLVMRustPassTimings::Entry &E : Timings->Entries) {
+    if (!First)
+      OS << ",";
+    First = false;
+    OS << "\n  {\"pass\": ";
+    writeJSONString(OS, E.Name);
+    OS << ", \"kind\": \"" << (E.Kind == PT_Function ? "function" : "module")
+       << "\", \"runs\": " << E.Runs
+       << ", \"seconds\": " << format("%.9f", E.Seconds) << "}";
+  }
+  OS << "\n]\n";
+}
+
 extern "C"
 bool LLVMRustPassManagerBuilderPopulateThinLTOPassManager(
   LLVMPassManagerBuilderRef PMBR,
@@ -405,6 +669,85 @@ extern "C" void LLVMRustDisposeTargetMachine(LLVMTargetMachineRef TM) {
   delete unwrap(TM);
 }
 
+// Creating a target machine means a registry lookup plus parsing the CPU and
+// feature strings into a subtarget, and rustc needs one for every codegen unit
+// it translates, optimizes and codegens. Target machines are only ever used
+// by one thread at a time but outlive the work item that created them, so
+// rather than keeping them per thread they're recycled through a global pool
+// keyed by everything that went into creating them.
+namespace {
+struct TargetMachinePool {
+  // Upper bound on the idle machines kept around for any one configuration,
+  // anything returned beyond that is deleted.
+  static const size_t MaxIdlePerKey = 32;
+
+  std::mutex Lock;
+  std::map<std::string, std::vector<TargetMachine *>> Idle;
+  DenseMap<const TargetMachine *, std::string> CheckedOut;
+};
+}
+
+static TargetMachinePool &getTargetMachinePool() {
+  static TargetMachinePool Pool;
+  return Pool;
+}
+
+extern "C" LLVMTargetMachineRef LLVMRustCheckoutTargetMachine(
+    const char *TripleStr, const char *CPU, const char *Feature,
+    LLVMRustCodeModel RustCM, LLVMRustRelocMode RustReloc,
+    LLVMRustCodeGenOptLevel RustOptLevel, bool UseSoftFloat,
+    bool PositionIndependentExecutable, bool FunctionSections,
+    bool DataSections) {
+  std::string Key;
+  raw_string_ostream KeyOS(Key);
+  KeyOS << TripleStr << '\n' << CPU << '\n' << Feature << '\n'
+        << int(RustCM) << ' ' << int(RustReloc) << ' ' << int(RustOptLevel)
+        << ' ' << UseSoftFloat << PositionIndependentExecutable
+        << FunctionSections << DataSections;
+  KeyOS.flush();
+
+  TargetMachinePool &Pool = getTargetMachinePool();
+  {
+    std::lock_guard<std::mutex> Guard(Pool.Lock);
+    auto It = Pool.Idle.find(Key);
+    if (It != Pool.Idle.end() && !It->second.empty()) {
+      TargetMachine *TM = It->second.back();
+      It->second.pop_back();
+      Pool.CheckedOut[TM] = Key;
+      return wrap(TM);
+    }
+  }
+
+  LLVMTargetMachineRef TM = LLVMRustCreateTargetMachine(
+      TripleStr, CPU, Feature, RustCM, RustReloc, RustOptLevel, UseSoftFloat,
+      PositionIndependentExecutable, FunctionSections, DataSections);
+  if (TM) {
+    std::lock_guard<std::mutex> Guard(Pool.Lock);
+    Pool.CheckedOut[unwrap(TM)] = Key;
+  }
+  return TM;
+}
+
+// Hands a target machine obtained from `LLVMRustCheckoutTargetMachine` back to
+// the pool. Machines that didn't come from the pool are simply deleted.
+extern "C" void LLVMRustReturnTargetMachine(LLVMTargetMachineRef TMR) {
+  TargetMachine *TM = unwrap(TMR);
+  TargetMachinePool &Pool = getTargetMachinePool();
+  {
+    std::lock_guard<std::mutex> Guard(Pool.Lock);
+    auto It = Pool.CheckedOut.find(TM);
+    if (It != Pool.CheckedOut.end()) {
+      std::vector<TargetMachine *> &Idle = Pool.Idle[It->second];
+      Pool.CheckedOut.erase(It);
+      if (Idle.size() < TargetMachinePool::MaxIdlePerKey) {
+        Idle.push_back(TM);
+        return;
+      }
+    }
+  }
+  delete TM;
+}
+
 // Unfortunately, LLVM doesn't expose a C API to add the corresponding analysis
 // passes for a target to a pass manager. We export that functionality through
 // this function.
@@ -418,12 +761,116 @@ extern "C" void LLVMRustAddAnalysisPasses(LLVMTargetMachineRef TM,
 
 extern "C" void LLVMRustConfigurePassManagerBuilder(
     LLVMPassManagerBuilderRef PMBR, LLVMRustCodeGenOptLevel OptLevel,
-    bool MergeFunctions, bool SLPVectorize, bool LoopVectorize) {
-  // Ignore mergefunc for now as enabling it causes crashes.
+    bool MergeFunctions, bool SLPVectorize, bool LoopVectorize,
+    const char *PGOGenPath, const char *PGOUsePath) {
+  // Ignore mergefunc for now as enabling it causes crashes. Identical
+  // functions are folded by `LLVMRustMergeIdenticalFunctions` instead.
   // unwrap(PMBR)->MergeFunctions = MergeFunctions;
   unwrap(PMBR)->SLPVectorize = SLPVectorize;
   unwrap(PMBR)->OptLevel = fromRust(OptLevel);
   unwrap(PMBR)->LoopVectorize = LoopVectorize;
+
+  // IR-level PGO: instrumentation is added right after the early inliner
+  // and the profile is read back at the same point, which also attaches
+  // function entry counts and branch weights for the rest of the pipeline.
+#if LLVM_VERSION_GE(4, 0)
+  if (PGOGenPath) {
+    assert(!PGOUsePath);
+    unwrap(PMBR)->EnablePGOInstrGen = true;
+    unwrap(PMBR)->PGOInstrGen = PGOGenPath;
+  }
+  if (PGOUsePath) {
+    assert(!PGOGenPath);
+    unwrap(PMBR)->PGOInstrUse = PGOUsePath;
+  }
+#else
+  if (PGOGenPath || PGOUsePath)
+    report_fatal_error("PGO requires LLVM 4.0 or later");
+#endif
+}
+
+enum class LLVMRustPassBuilderOptLevel {
+  O0,
+  O1,
+  O2,
+  O3,
+  Os,
+  Oz,
+};
+
+#if LLVM_VERSION_GE(4, 0)
+static PassBuilder::OptimizationLevel fromRust(LLVMRustPassBuilderOptLevel Level) {
+  switch (Level) {
+  case LLVMRustPassBuilderOptLevel::O0:
+    return PassBuilder::O0;
+  case LLVMRustPassBuilderOptLevel::O1:
+    return PassBuilder::O1;
+  case LLVMRustPassBuilderOptLevel::O2:
+    return PassBuilder::O2;
+  case LLVMRustPassBuilderOptLevel::O3:
+    return PassBuilder::O3;
+  case LLVMRustPassBuilderOptLevel::Os:
+    return PassBuilder::Os;
+  case LLVMRustPassBuilderOptLevel::Oz:
+    return PassBuilder::Oz;
+  default:
+    llvm_unreachable("Bad PassBuilderOptLevel.");
+  }
+}
+#endif
+
+// Optimizes a module with LLVM's default per-module pipeline for the given
+// level, built and run with the new pass manager. This stands in for the
+// function and module pass managers `PassManagerBuilder` populates for the
+// legacy pass manager, anything else (verification, passes requested on the
+// command line) is still run through the legacy pass manager.
+//
+// Note that the default pipelines can't be tuned on this LLVM, so unlike with
+// `PassManagerBuilder` the inline threshold and whether to unroll or
+// vectorize loops are those LLVM picks for the level.
+extern "C" bool
+LLVMRustRunNewPassManagerPipeline(LLVMModuleRef ModuleRef,
+                                  LLVMTargetMachineRef TMRef,
+                                  LLVMRustPassBuilderOptLevel OptLevel,
+                                  bool DisableSimplifyLibCalls,
+                                  bool DebugLogging) {
+#if LLVM_VERSION_GE(4, 0)
+  Module *M = unwrap(ModuleRef);
+  PassBuilder PB(unwrap(TMRef));
+
+  LoopAnalysisManager LAM(DebugLogging);
+  FunctionAnalysisManager FAM(DebugLogging);
+  CGSCCAnalysisManager CGAM(DebugLogging);
+  ModuleAnalysisManager MAM(DebugLogging);
+
+  // Register our own library info first, the `PassBuilder` won't replace an
+  // analysis which is already registered.
+  Triple TargetTriple(M->getTargetTriple());
+  TargetLibraryInfoImpl TLII(TargetTriple);
+  if (DisableSimplifyLibCalls)
+    TLII.disableAllFunctions();
+  FAM.registerPass([&] { return TargetLibraryAnalysis(TLII); });
+
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // There's no default pipeline for O0, all the legacy pass manager does
+  // there is inline `#[inline(always)]` functions.
+  ModulePassManager MPM(DebugLogging);
+  if (OptLevel == LLVMRustPassBuilderOptLevel::O0)
+    MPM.addPass(AlwaysInlinerPass());
+  else
+    MPM = PB.buildPerModuleDefaultPipeline(fromRust(OptLevel), DebugLogging);
+
+  MPM.run(*M, MAM);
+  return true;
+#else
+  LLVMRustSetLastError("the new pass manager is not available on this LLVM");
+  return false;
+#endif
 }
 
 // Unfortunately, the LLVM C API doesn't provide a way to set the `LibraryInfo`
@@ -471,14 +918,33 @@ extern "C" void LLVMRustRunFunctionPassManager(LLVMPassManagerRef PMR,
 }
 
 extern "C" void LLVMRustSetLLVMOptions(int Argc, char **Argv) {
-  // Initializing the command-line options more than once is not allowed. So,
-  // check if they've already been initialized.  (This could happen if we're
-  // being called from rustpkg, for example). If the arguments change, then
-  // that's just kinda unfortunate.
+  // LLVM's command-line options are global to the process, while a process
+  // may run several compilation sessions one after the other (the RLS or a
+  // build server, for example), each with its own `-C llvm-args`. Options
+  // can't be parsed twice without first being reset to their defaults, so only
+  // do that if the arguments actually changed since the last session.
+  //
+  // This is only sound if sessions with different arguments don't overlap.
+  static std::mutex Lock;
   static bool Initialized = false;
-  if (Initialized)
+  static std::vector<std::string> CurrentArgs;
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  std::vector<std::string> Args(Argv, Argv + Argc);
+  if (Initialized) {
+    if (Args == CurrentArgs)
+      return;
+#if LLVM_VERSION_GE(4, 0)
+    cl::ResetAllOptionOccurrences();
+#else
+    // Older LLVMs can't reset options, so the first session's arguments
+    // stay in effect. If the arguments change, then that's just kinda
+    // unfortunate.
     return;
+#endif
+  }
   Initialized = true;
+  CurrentArgs = std::move(Args);
   cl::ParseCommandLineOptions(Argc, Argv);
 }
 
@@ -499,6 +965,52 @@ static TargetMachine::CodeGenFileType fromRust(LLVMRustFileType Type) {
   }
 }
 
+// Stores the bitcode of `M` in a section of the object it's about to be
+// compiled to, along with the options needed to compile it again, the way
+// clang's `-fembed-bitcode` does. This needs to happen right before codegen,
+// and after any bitcode meant for LTO was written, as that would otherwise
+// carry a copy of itself.
+extern "C" bool LLVMRustEmbedBitcode(LLVMModuleRef M, const char *Cmdline,
+                                     size_t CmdlineLen) {
+#if LLVM_VERSION_GE(3, 9)
+  Module &Mod = *unwrap(M);
+  LLVMContext &Ctx = Mod.getContext();
+  bool IsMachO = Triple(Mod.getTargetTriple()).isOSBinFormatMachO();
+
+  if (Mod.getGlobalVariable("llvm.embedded.module", true)) {
+    LLVMRustSetLastError("module already has embedded bitcode");
+    return false;
+  }
+
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(&Mod, OS);
+
+  Constant *ModuleData = ConstantDataArray::getString(
+      Ctx, StringRef(Bitcode.data(), Bitcode.size()), false);
+  GlobalVariable *ModuleGV = new GlobalVariable(
+      Mod, ModuleData->getType(), true, GlobalValue::PrivateLinkage,
+      ModuleData, "llvm.embedded.module");
+  ModuleGV->setSection(IsMachO ? "__LLVM,__bitcode" : ".llvmbc");
+  ModuleGV->setAlignment(4);
+
+  Constant *CmdlineData =
+      ConstantDataArray::getString(Ctx, StringRef(Cmdline, CmdlineLen), false);
+  GlobalVariable *CmdlineGV = new GlobalVariable(
+      Mod, CmdlineData->getType(), true, GlobalValue::PrivateLinkage,
+      CmdlineData, "llvm.cmdline");
+  CmdlineGV->setSection(IsMachO ? "__LLVM,__cmdline" : ".llvmcmd");
+  CmdlineGV->setAlignment(1);
+
+  GlobalValue *Embedded[] = {ModuleGV, CmdlineGV};
+  appendToCompilerUsed(Mod, Embedded);
+  return true;
+#else
+  LLVMRustSetLastError("embedding bitcode requires LLVM 3.9 or later");
+  return false;
+#endif
+}
+
 extern "C" LLVMRustResult
 LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
                         LLVMModuleRef M, const char *Path,
@@ -526,6 +1038,192 @@ LLVMRustWriteOutputFile(LLVMTargetMachineRef Target, LLVMPassManagerRef PMR,
   return LLVMRustResult::Success;
 }
 
+// Whether `LLVMRustWriteAssemblyAndObject` can be used with this target
+// machine, which requires the target to come with an assembly parser.
+extern "C" bool LLVMRustTargetHasAsmParser(LLVMTargetMachineRef TM) {
+#if LLVM_VERSION_GE(4, 0)
+  return unwrap(TM)->getTarget().hasMCAsmParser();
+#else
+  return false;
+#endif
+}
+
+#if LLVM_VERSION_GE(4, 0)
+static void assemblerDiagHandler(const SMDiagnostic &Diag, void *Context) {
+  std::string *Error = static_cast<std::string *>(Context);
+  if (Diag.getKind() != SourceMgr::DK_Error || !Error->empty())
+    return;
+  raw_string_ostream OS(*Error);
+  Diag.print("<rustc>", OS, /* ShowColors */ false);
+}
+
+// Assembles the textual assembly in `Asm` into an object file written to
+// `OS`, the same way the integrated assembler would have done it had the
+// object been emitted straight from the module.
+static bool assembleToObject(TargetMachine *TM, StringRef Asm,
+                             raw_pwrite_stream &OS, std::string &Error) {
+  const Target &T = TM->getTarget();
+  const Triple &TT = TM->getTargetTriple();
+  const MCTargetOptions &MCOptions = TM->Options.MCOptions;
+
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(MemoryBuffer::getMemBuffer(Asm, "<asm>", false),
+                            SMLoc());
+  SrcMgr.setDiagHandler(assemblerDiagHandler, &Error);
+
+  std::unique_ptr<MCRegisterInfo> MRI(T.createMCRegInfo(TT.str()));
+  std::unique_ptr<MCAsmInfo> MAI(T.createMCAsmInfo(*MRI, TT.str()));
+  std::unique_ptr<MCInstrInfo> MCII(T.createMCInstrInfo());
+  std::unique_ptr<MCSubtargetInfo> STI(T.createMCSubtargetInfo(
+      TT.str(), TM->getTargetCPU(), TM->getTargetFeatureString()));
+  if (!MRI || !MAI || !MCII || !STI) {
+    Error = "target does not support assembling its own output";
+    return false;
+  }
+
+  MCObjectFileInfo MOFI;
+  MCContext Ctx(MAI.get(), MRI.get(), &MOFI, &SrcMgr);
+  MOFI.InitMCObjectFileInfo(TT, TM->isPositionIndependent(),
+                            TM->getCodeModel(), Ctx);
+
+  // Both of these are owned by the streamer created below.
+  MCCodeEmitter *CE = T.createMCCodeEmitter(*MCII, *MRI, Ctx);
+  MCAsmBackend *MAB =
+      T.createMCAsmBackend(*MRI, TT.str(), TM->getTargetCPU(), MCOptions);
+  if (!CE || !MAB) {
+    delete CE;
+    delete MAB;
+    Error = "target does not support assembling its own output";
+    return false;
+  }
+  std::unique_ptr<MCStreamer> Streamer(T.createMCObjectStreamer(
+      TT, Ctx, *MAB, OS, CE, *STI, MCOptions.MCRelaxAll,
+      MCOptions.MCIncrementalLinkerCompatible,
+      /* DWARFMustBeAtTheEnd */ false));
+
+  std::unique_ptr<MCAsmParser> Parser(
+      createMCAsmParser(SrcMgr, Ctx, *Streamer, *MAI));
+  std::unique_ptr<MCTargetAsmParser> TAP(
+      T.createMCAsmParser(*STI, *Parser, *MCII, MCOptions));
+  if (!TAP) {
+    Error = "target has no assembly parser";
+    return false;
+  }
+  Parser->setTargetParser(*TAP);
+
+  if (Parser->Run(/* NoInitialTextSection */ false)) {
+    if (Error.empty())
+      Error = "failed to assemble generated assembly";
+    return false;
+  }
+  return true;
+}
+#endif
+
+// Emits both an assembly listing to `AsmPath` and an object file to `ObjPath`
+// while running instruction selection and scheduling only once: the module is
+// compiled to assembly, which is then handed to the target's MC assembler.
+// Before, the module had to be cloned and codegened twice to get both.
+//
+// Callers must check `LLVMRustTargetHasAsmParser` first.
+extern "C" LLVMRustResult
+LLVMRustWriteAssemblyAndObject(LLVMTargetMachineRef TMR,
+                               LLVMPassManagerRef PMR, LLVMModuleRef M,
+                               const char *AsmPath, const char *ObjPath) {
+#if LLVM_VERSION_GE(4, 0)
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  TargetMachine *TM = unwrap(TMR);
+
+  SmallString<0> Asm;
+  {
+    raw_svector_ostream OS(Asm);
+    TM->addPassesToEmitFile(*PM, OS, TargetMachine::CGFT_AssemblyFile, false);
+    PM->run(*unwrap(M));
+
+    // The pass manager has a pointer to `OS`, see `LLVMRustWriteOutputFile`.
+    delete PM;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream AsmOS(AsmPath, EC, sys::fs::F_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  AsmOS << Asm;
+  AsmOS.close();
+  if (AsmOS.has_error()) {
+    AsmOS.clear_error();
+    LLVMRustSetLastError("failed to write assembly file");
+    return LLVMRustResult::Failure;
+  }
+
+  raw_fd_ostream ObjOS(ObjPath, EC, sys::fs::F_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return LLVMRustResult::Failure;
+  }
+  std::string Error;
+  if (!assembleToObject(TM, Asm, ObjOS, Error)) {
+    ObjOS.clear_error();
+    LLVMRustSetLastError(Error.c_str());
+    return LLVMRustResult::Failure;
+  }
+  ObjOS.close();
+  if (ObjOS.has_error()) {
+    ObjOS.clear_error();
+    LLVMRustSetLastError("failed to write object file");
+    return LLVMRustResult::Failure;
+  }
+  return LLVMRustResult::Success;
+#else
+  LLVMRustSetLastError("combined assembly and object emission requires "
+                       "LLVM 4.0 or later");
+  return LLVMRustResult::Failure;
+#endif
+}
+
+struct LLVMRustObjectBuffer {
+  SmallVector<char, 0> Data;
+};
+
+// Like `LLVMRustWriteOutputFile`, except that the output is emitted into a
+// buffer in memory. This lets rustc hand objects straight to the archive
+// writer rather than writing them out just to read them back in again.
+extern "C" LLVMRustObjectBuffer *
+LLVMRustWriteOutputToBuffer(LLVMTargetMachineRef Target,
+                            LLVMPassManagerRef PMR, LLVMModuleRef M,
+                            LLVMRustFileType RustFileType) {
+  llvm::legacy::PassManager *PM = unwrap<llvm::legacy::PassManager>(PMR);
+  auto FileType = fromRust(RustFileType);
+
+  auto Ret = llvm::make_unique<LLVMRustObjectBuffer>();
+  {
+    raw_svector_ostream OS(Ret->Data);
+    unwrap(Target)->addPassesToEmitFile(*PM, OS, FileType, false);
+    PM->run(*unwrap(M));
+
+    // Same as above, the pass manager has a pointer to `OS`.
+    delete PM;
+  }
+  return Ret.release();
+}
+
+extern "C" const char *
+LLVMRustObjectBufferPtr(const LLVMRustObjectBuffer *Buffer) {
+  return Buffer->Data.data();
+}
+
+extern "C" size_t
+LLVMRustObjectBufferLen(const LLVMRustObjectBuffer *Buffer) {
+  return Buffer->Data.size();
+}
+
+extern "C" void
+LLVMRustObjectBufferFree(LLVMRustObjectBuffer *Buffer) {
+  delete Buffer;
+}
+
 
 // Callback to demangle function name
 // Parameters:
@@ -542,6 +1240,10 @@ namespace {
 class RustAssemblyAnnotationWriter : public AssemblyAnnotationWriter {
   DemangleFn Demangle;
   std::vector<char> Buf;
+  // Demangled names by mangled name, with an empty string for names that
+  // aren't printed demangled. The same callees show up over and over again,
+  // so this saves calling back into Rust for each of them.
+  StringMap<std::string> Cache;
 
 public:
   RustAssemblyAnnotationWriter(DemangleFn Demangle) : Demangle(Demangle) {}
@@ -553,6 +1255,12 @@ public:
       return StringRef();
     }
 
+    auto Inserted = Cache.insert(std::make_pair(name, std::string()));
+    std::string &Cached = Inserted.first->second;
+    if (!Inserted.second) {
+      return Cached;
+    }
+
     if (Buf.size() < name.size() * 2) {
       // Semangled name usually shorter than mangled,
       // but allocate twice as much memory just in case
@@ -571,7 +1279,8 @@ public:
       return StringRef();
     }
 
-    return Demangled;
+    Cached = Demangled.str();
+    return Cached;
   }
 
   void emitFunctionAnnot(const Function *F,
@@ -699,21 +1408,48 @@ extern "C" void LLVMRustAddAlwaysInlinePass(LLVMPassManagerBuilderRef PMBR,
 #endif
 }
 
-extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
-                                           size_t Len) {
+// The symbols exported from the crate being compiled. This is built once per
+// crate and then shared by the restriction pass and ThinLTO, both of which
+// need to look up every global of every module in it.
+struct LLVMRustExportSet {
+  StringSet<> Names;
+#if LLVM_VERSION_LE(3, 8)
+  // Points into the keys of `Names`.
+  std::vector<const char *> NamePtrs;
+#else
+  DenseSet<GlobalValue::GUID> GUIDs;
+#endif
+};
+
+extern "C" LLVMRustExportSet *
+LLVMRustExportSetCreate(const char **Symbols, size_t Len) {
+  auto Ret = llvm::make_unique<LLVMRustExportSet>();
+  for (size_t I = 0; I < Len; I++) {
+    auto Inserted = Ret->Names.insert(Symbols[I]);
+    if (!Inserted.second)
+      continue;
+#if LLVM_VERSION_LE(3, 8)
+    Ret->NamePtrs.push_back(Inserted.first->getKeyData());
+#else
+    Ret->GUIDs.insert(GlobalValue::getGUID(Inserted.first->getKey()));
+#endif
+  }
+  return Ret.release();
+}
+
+extern "C" void LLVMRustExportSetFree(LLVMRustExportSet *Exports) {
+  delete Exports;
+}
+
+extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M,
+                                           const LLVMRustExportSet *Exports) {
   llvm::legacy::PassManager passes;
 
 #if LLVM_VERSION_LE(3, 8)
-  ArrayRef<const char *> Ref(Symbols, Len);
-  passes.add(llvm::createInternalizePass(Ref));
+  passes.add(llvm::createInternalizePass(Exports->NamePtrs));
 #else
   auto PreserveFunctions = [=](const GlobalValue &GV) {
-    for (size_t I = 0; I < Len; I++) {
-      if (GV.getName() == Symbols[I]) {
-        return true;
-      }
-    }
-    return false;
+    return Exports->Names.count(GV.getName()) != 0;
   };
 
   passes.add(llvm::createInternalizePass(PreserveFunctions));
@@ -722,17 +1458,347 @@ extern "C" void LLVMRustRunRestrictionPass(LLVMModuleRef M, char **Symbols,
   passes.run(*unwrap(M));
 }
 
-extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
-  for (Module::iterator GV = unwrap(M)->begin(), E = unwrap(M)->end(); GV != E;
-       ++GV) {
-    GV->setDoesNotThrow();
-    Function *F = dyn_cast<Function>(GV);
-    if (F == nullptr)
-      continue;
+#if LLVM_VERSION_GE(4, 0)
+// Replaces the body of `F` with a tail call to `G`, which does the exact same
+// thing. `F` keeps its own address, so this is always safe to do.
+static void writeThunk(Function *F, Function *G) {
+  DISubprogram *SP = F->getSubprogram();
+  AttributeSet Attrs = F->getAttributes();
+  F->dropAllReferences();
+  F->setAttributes(Attrs);
+
+  BasicBlock *BB = BasicBlock::Create(F->getContext(), "", F);
+  IRBuilder<> Builder(BB);
+  SmallVector<Value *, 16> Args;
+  for (Argument &Arg : F->args())
+    Args.push_back(&Arg);
+  CallInst *CI =
+      Builder.CreateCall(ConstantExpr::getBitCast(G, F->getType()), Args);
+  CI->setTailCall();
+  CI->setCallingConv(F->getCallingConv());
+  CI->setAttributes(Attrs);
+  // Inlinable calls in functions with debug info need a location.
+  if (SP) {
+    F->setSubprogram(SP);
+    CI->setDebugLoc(DILocation::get(F->getContext(), SP->getLine(), 0, SP));
+  }
+  if (F->getReturnType()->isVoidTy())
+    Builder.CreateRetVoid();
+  else
+    Builder.CreateRet(CI);
+}
+#endif
 
-    for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B) {
-      for (BasicBlock::iterator I = B->begin(), IE = B->end(); I != IE; ++I) {
-        if (isa<InvokeInst>(I)) {
+// Folds functions with identical code into one, which generic code produces
+// plenty of as different instantiations often end up compiling to the same
+// thing. This is a much more conservative take on LLVM's MergeFunctions:
+//
+// * Functions are only compared if neither can be replaced at link time, and
+//   are compared with LLVM's FunctionComparator, which is also what
+//   MergeFunctions uses.
+// * Of each set of identical functions the one with the smallest name is kept,
+//   so the result doesn't depend on the order of functions in the module.
+// * Local `unnamed_addr` functions which aren't `@llvm.used` are replaced
+//   outright, every other function becomes a thunk to the one kept, so
+//   neither symbols nor significant addresses ever go away. No aliases are
+//   created.
+//
+// Returns how many functions were folded.
+extern "C" unsigned LLVMRustMergeIdenticalFunctions(LLVMModuleRef M) {
+#if LLVM_VERSION_GE(4, 0)
+  Module &Mod = *unwrap(M);
+
+  SmallPtrSet<GlobalValue *, 8> Used;
+  collectUsedGlobalVariables(Mod, Used, /* CompilerUsed */ false);
+  collectUsedGlobalVariables(Mod, Used, /* CompilerUsed */ true);
+
+  // Buckets are visited in hash order, which is stable, to keep the output
+  // deterministic.
+  std::map<FunctionComparator::FunctionHash, std::vector<Function *>> Buckets;
+  for (Function &F : Mod) {
+    if (F.isDeclaration() || F.hasAvailableExternallyLinkage() ||
+        F.isInterposable() || F.isVarArg() ||
+        F.hasFnAttribute(Attribute::Naked))
+      continue;
+    bool HasInAlloca = false;
+    for (Argument &Arg : F.args())
+      HasInAlloca |= Arg.hasInAllocaAttr();
+    if (HasInAlloca)
+      continue;
+    Buckets[FunctionComparator::functionHash(F)].push_back(&F);
+  }
+
+  // The hash only covers the shape of the control flow, so a bucket may hold
+  // many distinct functions. Bound the number of comparisons for each.
+  const size_t MaxDistinctPerBucket = 64;
+
+  GlobalNumberState GlobalNumbers;
+  std::vector<std::pair<Function *, Function *>> Folds;
+  for (auto &Bucket : Buckets) {
+    std::vector<Function *> &Fns = Bucket.second;
+    if (Fns.size() < 2)
+      continue;
+    std::stable_sort(Fns.begin(), Fns.end(), [](Function *A, Function *B) {
+      return A->getName() < B->getName();
+    });
+
+    std::vector<Function *> Distinct;
+    for (Function *F : Fns) {
+      Function *Same = nullptr;
+      for (Function *D : Distinct) {
+        if (FunctionComparator(D, F, &GlobalNumbers).compare() == 0) {
+          Same = D;
+          break;
+        }
+      }
+      if (Same)
+        Folds.push_back(std::make_pair(F, Same));
+      else if (Distinct.size() < MaxDistinctPerBucket)
+        Distinct.push_back(F);
+    }
+  }
+
+  // Only now that all comparisons are done is anything modified. The kept
+  // functions are never folded themselves, so there are no chains.
+  for (auto &Fold : Folds) {
+    Function *F = Fold.first;
+    Function *G = Fold.second;
+    if (F->hasLocalLinkage() && F->hasGlobalUnnamedAddr() && !Used.count(F)) {
+      F->replaceAllUsesWith(ConstantExpr::getBitCast(G, F->getType()));
+      F->eraseFromParent();
+    } else {
+      writeThunk(F, G);
+    }
+  }
+  return Folds.size();
+#else
+  return 0;
+#endif
+}
+
+#if LLVM_VERSION_GE(4, 0)
+// Bits of `__cpu_model.__cpu_features[0]`, as filled in by
+// `__cpu_indicator_init` in libgcc and compiler-rt.
+struct X86RuntimeFeature {
+  const char *Name;
+  unsigned Bit;
+};
+
+static const X86RuntimeFeature X86RuntimeFeatures[] = {
+    {"cmov", 0},      {"mmx", 1},         {"popcnt", 2},     {"sse", 3},
+    {"sse2", 4},      {"sse3", 5},        {"ssse3", 6},      {"sse4.1", 7},
+    {"sse4.2", 8},    {"avx", 9},         {"avx2", 10},      {"sse4a", 11},
+    {"fma4", 12},     {"xop", 13},        {"fma", 14},       {"avx512f", 15},
+    {"bmi", 16},      {"bmi2", 17},       {"aes", 18},       {"pclmul", 19},
+    {"avx512vl", 20}, {"avx512bw", 21},   {"avx512dq", 22},  {"avx512cd", 23},
+    {"avx512er", 24}, {"avx512pf", 25},   {"avx512vbmi", 26},
+    {"avx512ifma", 27},
+};
+
+struct TargetClone {
+  std::string Features;
+  uint32_t Mask;
+  bool InBaseline;
+};
+
+// Parses one `;`-separated entry of a `rust-target-clones` attribute, which
+// uses the same syntax as `target-features`. Features which are enabled need
+// to be detectable at run time, disabled ones are only passed along.
+static bool parseTargetClone(LLVMTargetMachineRef TM, StringRef Entry,
+                             TargetClone &Clone) {
+  SmallVector<StringRef, 8> Features;
+  Entry.split(Features, ',', -1, false);
+  Clone.Mask = 0;
+  Clone.InBaseline = true;
+  for (StringRef Feature : Features) {
+    Feature = Feature.trim();
+    if (Feature.empty())
+      continue;
+    bool Enable = !Feature.startswith("-");
+    if (Feature.startswith("+") || Feature.startswith("-"))
+      Feature = Feature.drop_front();
+    if (!Clone.Features.empty())
+      Clone.Features += ",";
+    Clone.Features += Enable ? "+" : "-";
+    Clone.Features += Feature;
+    if (!Enable)
+      continue;
+
+    auto Known = std::find_if(
+        std::begin(X86RuntimeFeatures), std::end(X86RuntimeFeatures),
+        [&](const X86RuntimeFeature &F) {
+          return Feature == F.Name;
+        });
+    if (Known == std::end(X86RuntimeFeatures)) {
+      LLVMRustSetLastError(("target feature `" + Feature.str() +
+                            "` cannot be detected at run time")
+                               .c_str());
+      return false;
+    }
+    Clone.Mask |= 1u << Known->Bit;
+    Clone.InBaseline &= LLVMRustHasFeature(TM, Known->Name);
+  }
+  return true;
+}
+
+// Fills in `Resolver` to return the first of `Clones` whose features the CPU
+// we're running on has, or `Default` if there is none.
+static void buildTargetClonesResolver(Module &Mod, Function *Resolver,
+                                      ArrayRef<TargetClone> Clones,
+                                      ArrayRef<Function *> ClonedFns,
+                                      Function *Default) {
+  LLVMContext &Ctx = Mod.getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int8PtrTy = Type::getInt8PtrTy(Ctx);
+
+  // struct { unsigned vendor, type, subtype; unsigned features[1]; }
+  StructType *CpuModelTy = StructType::get(
+      Ctx, {Int32Ty, Int32Ty, Int32Ty, ArrayType::get(Int32Ty, 1)});
+  Constant *CpuModel = Mod.getOrInsertGlobal("__cpu_model", CpuModelTy);
+  Constant *CpuInit = Mod.getOrInsertFunction(
+      "__cpu_indicator_init", FunctionType::get(Type::getVoidTy(Ctx), false));
+
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "start", Resolver));
+  // Resolvers may run before any constructor did, so initialize explicitly.
+  Builder.CreateCall(CpuInit);
+  Value *Indices[] = {Builder.getInt32(0), Builder.getInt32(3),
+                      Builder.getInt32(0)};
+  Value *CpuFeatures = Builder.CreateLoad(
+      Builder.CreateInBoundsGEP(CpuModelTy, CpuModel, Indices));
+
+  for (size_t I = 0; I < Clones.size(); I++) {
+    Value *Mask = Builder.getInt32(Clones[I].Mask);
+    Value *Has =
+        Builder.CreateICmpEQ(Builder.CreateAnd(CpuFeatures, Mask), Mask);
+    BasicBlock *Found = BasicBlock::Create(Ctx, "found", Resolver);
+    BasicBlock *Next = BasicBlock::Create(Ctx, "next", Resolver);
+    Builder.CreateCondBr(Has, Found, Next);
+    Builder.SetInsertPoint(Found);
+    Builder.CreateRet(ConstantExpr::getBitCast(ClonedFns[I], Int8PtrTy));
+    Builder.SetInsertPoint(Next);
+  }
+  Builder.CreateRet(ConstantExpr::getBitCast(Default, Int8PtrTy));
+}
+#endif
+
+// Expands functions carrying a `rust-target-clones` attribute into one clone
+// per listed feature set, each compiled with those features enabled, plus the
+// original as the default. The function's symbol becomes an ifunc whose
+// resolver picks the first clone the CPU supports when the program is loaded.
+//
+// Clones whose features the target machine enables anyway are dropped along
+// with everything after them, as they'd never lose against the default.
+//
+// Only x86 ELF targets are supported, as the resolver relies on the CPU model
+// that `__cpu_indicator_init` fills in.
+extern "C" bool LLVMRustExpandTargetClones(LLVMModuleRef M,
+                                           LLVMTargetMachineRef TM) {
+  Module &Mod = *unwrap(M);
+
+  std::vector<Function *> Marked;
+  for (Function &F : Mod)
+    if (F.hasFnAttribute("rust-target-clones"))
+      Marked.push_back(&F);
+  if (Marked.empty())
+    return true;
+
+#if LLVM_VERSION_GE(4, 0)
+  Triple TargetTriple(Mod.getTargetTriple());
+  if (TargetTriple.getArch() != Triple::x86 &&
+      TargetTriple.getArch() != Triple::x86_64) {
+    LLVMRustSetLastError("function multiversioning is only supported on x86");
+    return false;
+  }
+
+  for (Function *F : Marked) {
+    StringRef Spec =
+        F->getFnAttribute("rust-target-clones").getValueAsString();
+    SmallVector<StringRef, 4> Entries;
+    Spec.split(Entries, ';', -1, false);
+    F->removeFnAttr("rust-target-clones");
+    if (F->isDeclaration())
+      continue;
+
+    std::vector<TargetClone> Clones;
+    for (StringRef Entry : Entries) {
+      TargetClone Clone;
+      if (!parseTargetClone(TM, Entry, Clone))
+        return false;
+      if (Clone.InBaseline)
+        break;
+      if (Clone.Mask != 0)
+        Clones.push_back(Clone);
+    }
+    if (Clones.empty())
+      continue;
+
+    std::string BaseFeatures;
+    if (F->hasFnAttribute("target-features"))
+      BaseFeatures =
+          F->getFnAttribute("target-features").getValueAsString().str();
+
+    std::string Name = F->getName().str();
+    std::vector<Function *> ClonedFns;
+    for (TargetClone &Clone : Clones) {
+      ValueToValueMapTy VMap;
+      Function *C = CloneFunction(F, VMap);
+      std::string Suffix = Clone.Features;
+      std::replace(Suffix.begin(), Suffix.end(), ',', '.');
+      Suffix.erase(std::remove(Suffix.begin(), Suffix.end(), '+'),
+                   Suffix.end());
+      C->setName(Name + "." + Suffix);
+      C->setLinkage(GlobalValue::InternalLinkage);
+      C->setVisibility(GlobalValue::DefaultVisibility);
+      C->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+      C->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      C->setComdat(nullptr);
+      C->addFnAttr("target-features", BaseFeatures.empty()
+                                          ? Clone.Features
+                                          : BaseFeatures + "," +
+                                                Clone.Features);
+      ClonedFns.push_back(C);
+    }
+
+    // The original takes over as the default clone, and its symbol, linkage
+    // and visibility go to the ifunc replacing it.
+    GlobalValue::LinkageTypes Linkage = F->getLinkage();
+    F->setName(Name + ".default");
+    Function *Resolver = Function::Create(
+        FunctionType::get(Type::getInt8PtrTy(Mod.getContext()), false),
+        GlobalValue::InternalLinkage, Name + ".resolver", &Mod);
+    Resolver->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    GlobalIFunc *IFunc =
+        GlobalIFunc::create(F->getValueType(), F->getType()->getAddressSpace(),
+                            Linkage, Name, Resolver, &Mod);
+    IFunc->setVisibility(F->getVisibility());
+    IFunc->setDLLStorageClass(F->getDLLStorageClass());
+    IFunc->setUnnamedAddr(F->getUnnamedAddr());
+    F->replaceAllUsesWith(IFunc);
+    F->setLinkage(GlobalValue::InternalLinkage);
+    F->setVisibility(GlobalValue::DefaultVisibility);
+    F->setDLLStorageClass(GlobalValue::DefaultStorageClass);
+    F->setComdat(nullptr);
+
+    buildTargetClonesResolver(Mod, Resolver, Clones, ClonedFns, F);
+  }
+  return true;
+#else
+  LLVMRustSetLastError("function multiversioning requires LLVM 4.0");
+  return false;
+#endif
+}
+
+extern "C" void LLVMRustMarkAllFunctionsNounwind(LLVMModuleRef M) {
+  for (Module::iterator GV = unwrap(M)->begin(), E = unwrap(M)->end(); GV != E;
+       ++GV) {
+    GV->setDoesNotThrow();
+    Function *F = dyn_cast<Function>(GV);
+    if (F == nullptr)
+      continue;
+
+    for (Function::iterator B = F->begin(), BE = F->end(); B != BE; ++B) {
+      for (BasicBlock::iterator I = B->begin(), IE = B->end(); I != IE; ++I) {
+        if (isa<InvokeInst>(I)) {
           InvokeInst *CI = cast<InvokeInst>(I);
           CI->setDoesNotThrow();
         }
@@ -814,6 +1880,14 @@ LLVMRustWriteThinBitcodeToFile(LLVMPassManagerRef PMR,
   return true;
 }
 
+// Timings of the phases of building the global ThinLTO analysis, reported
+// back to rustc through `LLVMRustThinLTOGetDataStats`.
+struct LLVMRustThinLTODataStats {
+  double LoadSeconds;
+  double ImportSeconds;
+  double ResolveSeconds;
+};
+
 // This is a shared data structure which *must* be threadsafe to share
 // read-only amongst threads. This also corresponds basically to the arguments
 // of the `ProcessThinLTOModule` function in the LLVM source.
@@ -827,6 +1901,11 @@ struct LLVMRustThinLTOData {
   // from.
   StringMap<MemoryBufferRef> ModuleMap;
 
+  // The bitcode of each module in `ModuleMap` located and validated ahead of
+  // time. Each module we import from is lazily loaded from one of these, which
+  // saves rescanning the bitcode every time a module is imported from.
+  StringMap<std::unique_ptr<BitcodeModule>> BitcodeModules;
+
   // A set that we manage of everything we *don't* want internalized. Note that
   // this includes all transitive references right now as well, but it may not
   // always!
@@ -837,6 +1916,27 @@ struct LLVMRustThinLTOData {
   StringMap<FunctionImporter::ImportMapTy> ImportLists;
   StringMap<FunctionImporter::ExportSetTy> ExportLists;
   StringMap<GVSummaryMapTy> ModuleToDefinedGVSummaries;
+
+  // The linkage that each LinkOnce/Weak symbol was resolved to, per module.
+  // This doesn't affect the per-module passes below (they read the index) but
+  // it's part of what's compared when reusing ThinLTO results.
+  StringMap<std::map<GlobalValue::GUID, GlobalValue::LinkageTypes>> ResolvedODR;
+
+  // How many other modules import from each module.
+  StringMap<uint64_t> ImportedBy;
+
+  // How long the phases of `LLVMRustCreateThinLTOData` took.
+  LLVMRustThinLTODataStats Stats;
+
+  // SHA-1 of the serialized form of each module in `ModuleMap`. This is only
+  // filled in by `LLVMRustThinLTOHashModules` when rustc is reusing ThinLTO
+  // results across compilations, otherwise it's empty.
+  StringMap<std::string> ModuleHashes;
+
+  // The bitcode of the modules to import from, when this data was loaded from
+  // an index shard by `LLVMRustThinLTOLoadIndexShard`. `ModuleMap` points into
+  // these buffers.
+  std::vector<std::unique_ptr<MemoryBuffer>> ShardInputs;
 };
 
 // Just an argument to the `LLVMRustCreateThinLTOData` function below.
@@ -869,6 +1969,13 @@ getFirstDefinitionForLinker(const GlobalValueSummaryList &GVSummaryList) {
   return FirstDefForLinker->get();
 }
 
+static GlobalValue::GUID
+getGUID(const ValueInfo &VI) {
+  if (VI.isGUID())
+    return VI.getGUID();
+  return VI.getValue()->getGUID();
+}
+
 // This is a helper function we added that isn't present in LLVM's source.
 //
 // The way LTO works in Rust is that we typically have a number of symbols that
@@ -876,44 +1983,79 @@ getFirstDefinitionForLinker(const GlobalValueSummaryList &GVSummaryList) {
 // doesn't accidentally internalize any of these and otherwise is always
 // ready to keep them linking correctly.
 //
-// This function will recursively walk the `GUID` provided and all of its
-// references, as specified in the `Index`. In other words, we're taking a
-// `GUID` as input, adding it to `Preserved`, and then taking all `GUID`
-// items that the input references and recursing.
+// This function will walk the `GUID` provided and all of its references, as
+// specified in the `Index`. In other words, we're taking a `GUID` as input,
+// adding it to `Preserved`, and then doing the same for all `GUID` items that
+// the input transitively references. Call graphs can be quite deep, so this
+// uses an explicit worklist rather than recursion.
 static void
 addPreservedGUID(const ModuleSummaryIndex &Index,
                  DenseSet<GlobalValue::GUID> &Preserved,
-                 GlobalValue::GUID GUID) {
-  if (Preserved.count(GUID))
-    return;
-  Preserved.insert(GUID);
+                 GlobalValue::GUID Root) {
+  std::vector<GlobalValue::GUID> Worklist;
+  Worklist.push_back(Root);
+  while (!Worklist.empty()) {
+    GlobalValue::GUID GUID = Worklist.back();
+    Worklist.pop_back();
+    if (!Preserved.insert(GUID).second)
+      continue;
 
-  auto SummaryList = Index.findGlobalValueSummaryList(GUID);
-  if (SummaryList == Index.end())
-    return;
-  for (auto &Summary : SummaryList->second) {
-    for (auto &Ref : Summary->refs()) {
-      if (Ref.isGUID()) {
-        addPreservedGUID(Index, Preserved, Ref.getGUID());
-      } else {
-        auto Value = Ref.getValue();
-        addPreservedGUID(Index, Preserved, Value->getGUID());
+    auto SummaryList = Index.findGlobalValueSummaryList(GUID);
+    if (SummaryList == Index.end())
+      continue;
+    for (auto &Summary : SummaryList->second) {
+      for (auto &Ref : Summary->refs())
+        Worklist.push_back(getGUID(Ref));
+
+      GlobalValueSummary *GVSummary = Summary.get();
+      if (isa<FunctionSummary>(GVSummary)) {
+        FunctionSummary *FS = cast<FunctionSummary>(GVSummary);
+        for (auto &Call: FS->calls())
+          Worklist.push_back(getGUID(Call.first));
+        for (auto &GUID: FS->type_tests())
+          Worklist.push_back(GUID);
       }
     }
+  }
+}
 
-    GlobalValueSummary *GVSummary = Summary.get();
-    if (isa<FunctionSummary>(GVSummary)) {
-      FunctionSummary *FS = cast<FunctionSummary>(GVSummary);
-      for (auto &Call: FS->calls()) {
-        if (Call.first.isGUID()) {
-          addPreservedGUID(Index, Preserved, Call.first.getGUID());
-        } else {
-          auto Value = Call.first.getValue();
-          addPreservedGUID(Index, Preserved, Value->getGUID());
+// Another helper not present in LLVM, used instead of `addPreservedGUID`
+// when only the true roots are preserved.
+//
+// The import/export lists computed by LLVM only cover values that are actually
+// imported into other modules, but a module can also simply reference a value
+// defined in another module (e.g. a call to a function too large to import).
+// Such values must not be internalized, so this collects every `GUID` that is
+// referenced from a module other than one defining it. Unlike
+// `addPreservedGUID` this only looks at direct references, so values that are
+// only used within their own module can still be internalized.
+static void
+addCrossModuleReferences(const ModuleSummaryIndex &Index,
+                         DenseSet<GlobalValue::GUID> &Referenced) {
+  for (auto &I : Index) {
+    for (auto &Summary : I.second) {
+      StringRef ModulePath = Summary->modulePath();
+      auto AddIfDefinedElsewhere = [&](GlobalValue::GUID GUID) {
+        if (Referenced.count(GUID))
+          return;
+        auto SummaryList = Index.findGlobalValueSummaryList(GUID);
+        if (SummaryList == Index.end())
+          return;
+        for (auto &Definition : SummaryList->second) {
+          if (Definition->modulePath() != ModulePath) {
+            Referenced.insert(GUID);
+            return;
+          }
         }
-      }
-      for (auto &GUID: FS->type_tests()) {
-        addPreservedGUID(Index, Preserved, GUID);
+      };
+
+      for (auto &Ref : Summary->refs())
+        AddIfDefinedElsewhere(getGUID(Ref));
+      GlobalValueSummary *GVSummary = Summary.get();
+      if (isa<FunctionSummary>(GVSummary)) {
+        FunctionSummary *FS = cast<FunctionSummary>(GVSummary);
+        for (auto &Call: FS->calls())
+          AddIfDefinedElsewhere(getGUID(Call.first));
       }
     }
   }
@@ -925,57 +2067,119 @@ addPreservedGUID(const ModuleSummaryIndex &Index,
 extern "C" LLVMRustThinLTOData*
 LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
                           int num_modules,
-                          const char **preserved_symbols,
-                          int num_symbols) {
+                          const LLVMRustExportSet *Exports,
+                          bool preserve_roots_only,
+                          unsigned max_threads) {
   auto Ret = llvm::make_unique<LLVMRustThinLTOData>();
+  auto PhaseStart = std::chrono::steady_clock::now();
+  auto EndPhase = [&PhaseStart](double &Seconds) {
+    auto Now = std::chrono::steady_clock::now();
+    Seconds = std::chrono::duration<double>(Now - PhaseStart).count();
+    PhaseStart = Now;
+  };
 
-  // Load each module's summary and merge it into one combined index
-  for (int i = 0; i < num_modules; i++) {
-    auto module = &modules[i];
-    StringRef buffer(module->data, module->len);
-    MemoryBufferRef mem_buffer(buffer, module->identifier);
+  // Load each module's summary. This is done concurrently as there may be
+  // hundreds of modules here, each of which is independent of the others.
+  // Every module gets its own slot for a summary or an error, so the summaries
+  // can afterwards be merged into the combined index in a deterministic order.
+  std::vector<std::unique_ptr<ModuleSummaryIndex>> Summaries(num_modules);
+  std::vector<std::unique_ptr<BitcodeModule>> Bitcode(num_modules);
+  std::vector<std::string> Errors(num_modules);
+  {
+    // rustc only gives us as many threads as it has jobserver tokens for.
+    unsigned Threads = std::min<unsigned>(num_modules, max_threads);
+    ThreadPool Pool(std::max(Threads, 1u));
+    for (int i = 0; i < num_modules; i++) {
+      auto module = &modules[i];
+      StringRef buffer(module->data, module->len);
+      MemoryBufferRef mem_buffer(buffer, module->identifier);
+
+      Ret->ModuleMap[module->identifier] = mem_buffer;
+
+      Pool.async([&Summaries, &Bitcode, &Errors, mem_buffer, i] {
+        Expected<std::vector<BitcodeModule>> BMsOrErr =
+          getBitcodeModuleList(mem_buffer);
+        if (!BMsOrErr) {
+          Errors[i] = toString(BMsOrErr.takeError());
+          return;
+        }
+        if (BMsOrErr->size() != 1) {
+          Errors[i] = "expected exactly one module in bitcode of " +
+                      mem_buffer.getBufferIdentifier().str();
+          return;
+        }
+        Bitcode[i] = llvm::make_unique<BitcodeModule>((*BMsOrErr)[0]);
 
-    Ret->ModuleMap[module->identifier] = mem_buffer;
+        Expected<std::unique_ptr<object::ModuleSummaryIndexObjectFile>> ObjOrErr =
+          object::ModuleSummaryIndexObjectFile::create(mem_buffer);
+        if (!ObjOrErr) {
+          Errors[i] = toString(ObjOrErr.takeError());
+          return;
+        }
+        Summaries[i] = (*ObjOrErr)->takeIndex();
+      });
+    }
+    Pool.wait();
+  }
 
-    Expected<std::unique_ptr<object::ModuleSummaryIndexObjectFile>> ObjOrErr =
-      object::ModuleSummaryIndexObjectFile::create(mem_buffer);
-    if (!ObjOrErr) {
-      LLVMRustSetLastError(toString(ObjOrErr.takeError()).c_str());
+  // Merge everything into one combined index, in the order the modules were
+  // given to us. If anything failed to load we report the first failure.
+  for (int i = 0; i < num_modules; i++) {
+    if (!Summaries[i]) {
+      LLVMRustSetLastError(Errors[i].c_str());
       return nullptr;
     }
-    auto Index = (*ObjOrErr)->takeIndex();
-    Ret->Index.mergeFrom(std::move(Index), i);
+    Ret->Index.mergeFrom(std::move(Summaries[i]), i);
+    Ret->BitcodeModules[modules[i].identifier] = std::move(Bitcode[i]);
   }
+  EndPhase(Ret->Stats.LoadSeconds);
 
   // Collect for each module the list of function it defines (GUID -> Summary)
   Ret->Index.collectDefinedGVSummariesPerModule(Ret->ModuleToDefinedGVSummaries);
 
   // Convert the preserved symbols set from string to GUID, this is then needed
-  // for internalization. We use `addPreservedGUID` to include any transitively
-  // used symbol as well.
-  for (int i = 0; i < num_symbols; i++) {
-    addPreservedGUID(Ret->Index,
-                     Ret->GUIDPreservedSymbols,
-                     GlobalValue::getGUID(preserved_symbols[i]));
+  // for internalization.
+  //
+  // By default we use `addPreservedGUID` to include any transitively used
+  // symbol as well. If only roots are preserved, however, we instead let LLVM
+  // figure out what's dead starting from the roots, and only additionally
+  // preserve what's referenced across modules. This allows much more to be
+  // internalized.
+  DenseSet<GlobalValue::GUID> DeadSymbols;
+  if (preserve_roots_only) {
+    Ret->GUIDPreservedSymbols.insert(Exports->GUIDs.begin(),
+                                     Exports->GUIDs.end());
+    DeadSymbols = computeDeadSymbols(Ret->Index, Ret->GUIDPreservedSymbols);
+    addCrossModuleReferences(Ret->Index, Ret->GUIDPreservedSymbols);
+  } else {
+    for (GlobalValue::GUID GUID : Exports->GUIDs) {
+      addPreservedGUID(Ret->Index, Ret->GUIDPreservedSymbols, GUID);
+    }
   }
 
   // Collect the import/export lists for all modules from the call-graph in the
   // combined index
   //
-  // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`
-  computeDeadSymbols(Ret->Index, Ret->GUIDPreservedSymbols);
+  // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`. Note that when
+  // everything reachable is preserved there's nothing dead, so we only hand
+  // dead symbols to LLVM if just the roots are preserved.
   ComputeCrossModuleImport(
     Ret->Index,
     Ret->ModuleToDefinedGVSummaries,
     Ret->ImportLists,
-    Ret->ExportLists
+    Ret->ExportLists,
+    preserve_roots_only ? &DeadSymbols : nullptr
   );
+  for (auto &ImportList : Ret->ImportLists) {
+    for (auto &Source : ImportList.second)
+      Ret->ImportedBy[Source.first()]++;
+  }
+  EndPhase(Ret->Stats.ImportSeconds);
 
   // Resolve LinkOnce/Weak symbols, this has to be computed early be cause it
   // impacts the caching.
   //
   // This is copied from `lib/LTO/ThinLTOCodeGenerator.cpp`
-  StringMap<std::map<GlobalValue::GUID, GlobalValue::LinkageTypes>> ResolvedODR;
   DenseMap<GlobalValue::GUID, const GlobalValueSummary *> PrevailingCopy;
   for (auto &I : Ret->Index) {
     if (I.second.size() > 1)
@@ -990,7 +2194,7 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
   auto recordNewLinkage = [&](StringRef ModuleIdentifier,
                               GlobalValue::GUID GUID,
                               GlobalValue::LinkageTypes NewLinkage) {
-    ResolvedODR[ModuleIdentifier][GUID] = NewLinkage;
+    Ret->ResolvedODR[ModuleIdentifier][GUID] = NewLinkage;
   };
   thinLTOResolveWeakForLinkerInIndex(Ret->Index, isPrevailing, recordNewLinkage);
   auto isExported = [&](StringRef ModuleIdentifier, GlobalValue::GUID GUID) {
@@ -1000,15 +2204,596 @@ LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
       Ret->GUIDPreservedSymbols.count(GUID);
   };
   thinLTOInternalizeAndPromoteInIndex(Ret->Index, isExported);
+  EndPhase(Ret->Stats.ResolveSeconds);
 
   return Ret.release();
 }
 
+extern "C" void
+LLVMRustThinLTOGetDataStats(const LLVMRustThinLTOData *Data,
+                            LLVMRustThinLTODataStats *Stats) {
+  *Stats = Data->Stats;
+}
+
+// What the global analysis decided about a single module, for rustc to
+// report on with `-Z thinlto-report`.
+//
+// `ImportedInstructions` is the size of what this module actually pulls in,
+// and `ExportedInstructions` is how much all other modules pull in from this
+// one, which is what points out import magnets. `SourceModuleBytes` is the
+// total size of the modules imported from, however little is taken from each.
+struct LLVMRustThinLTOModuleStats {
+  uint64_t ImportedFunctions;
+  uint64_t ImportedGlobals;
+  uint64_t ImportedInstructions;
+  uint64_t SourceModules;
+  uint64_t SourceModuleBytes;
+  uint64_t Exports;
+  uint64_t ExportedInstructions;
+  uint64_t ImportedBy;
+};
+
+// The number of instructions of a function imported from `ModulePath`, or 0
+// for anything that isn't a function.
+static uint64_t importedInstCount(const LLVMRustThinLTOData *Data,
+                                  GlobalValue::GUID GUID,
+                                  StringRef ModulePath) {
+  const GlobalValueSummary *Summary =
+    Data->Index.findSummaryInModule(GUID, ModulePath);
+  if (!Summary)
+    return 0;
+  if (auto *AS = dyn_cast<AliasSummary>(Summary))
+    Summary = &AS->getAliasee();
+  if (auto *FS = dyn_cast<FunctionSummary>(Summary))
+    return FS->instCount();
+  return 0;
+}
+
+extern "C" void
+LLVMRustThinLTOGetModuleStats(const LLVMRustThinLTOData *Data,
+                              const char *ModuleId,
+                              LLVMRustThinLTOModuleStats *Stats) {
+  *Stats = LLVMRustThinLTOModuleStats();
+
+  auto ImportList = Data->ImportLists.find(ModuleId);
+  if (ImportList != Data->ImportLists.end()) {
+    for (auto &Source : ImportList->second) {
+      Stats->SourceModules++;
+      Stats->SourceModuleBytes +=
+        Data->ModuleMap.lookup(Source.first()).getBufferSize();
+      for (auto &Imported : Source.second) {
+        const GlobalValueSummary *Summary =
+          Data->Index.findSummaryInModule(Imported.first, Source.first());
+        if (Summary && isa<GlobalVarSummary>(Summary))
+          Stats->ImportedGlobals++;
+        else
+          Stats->ImportedFunctions++;
+        Stats->ImportedInstructions +=
+          importedInstCount(Data, Imported.first, Source.first());
+      }
+    }
+  }
+
+  for (auto &Importer : Data->ImportLists) {
+    auto Source = Importer.second.find(ModuleId);
+    if (Source == Importer.second.end())
+      continue;
+    for (auto &Imported : Source->second)
+      Stats->ExportedInstructions +=
+        importedInstCount(Data, Imported.first, ModuleId);
+  }
+
+  auto ExportList = Data->ExportLists.find(ModuleId);
+  if (ExportList != Data->ExportLists.end())
+    Stats->Exports = ExportList->second.size();
+  Stats->ImportedBy = Data->ImportedBy.lookup(ModuleId);
+}
+
 extern "C" void
 LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data) {
   delete Data;
 }
 
+// Hashes the serialized form of every module participating in ThinLTO, a
+// prerequisite for the cache keys and analysis files below. This isn't done as
+// part of `LLVMRustCreateThinLTOData` as it's only needed when rustc is
+// reusing ThinLTO results across compilations.
+extern "C" void
+LLVMRustThinLTOHashModules(LLVMRustThinLTOData *Data) {
+  for (auto &Entry : Data->ModuleMap) {
+    if (Data->ModuleHashes.count(Entry.first()))
+      continue;
+    SHA1 Hasher;
+    Hasher.update(Entry.second.getBuffer());
+    Data->ModuleHashes[Entry.first()] = Hasher.result().str();
+  }
+}
+
+// Everything in the global ThinLTO analysis which influences what a single
+// module looks like after the per-module ThinLTO steps below. This is what's
+// persisted by `LLVMRustThinLTOWriteAnalysis`, and two modules with equal
+// records (and equal contents) end up being optimized identically.
+struct ThinLTOModuleRecord {
+  // SHA-1 of the module's bitcode
+  std::string Hash;
+  // For each module imported from (sorted), its hash and the imported GUIDs
+  std::vector<std::tuple<std::string, std::string, std::vector<uint64_t>>>
+    Imports;
+  // Sorted GUIDs exported from this module
+  std::vector<uint64_t> Exports;
+  // Resolved linkage of weak symbols, and the final linkage of everything
+  // defined in this module, both sorted by GUID
+  std::vector<std::pair<uint64_t, uint8_t>> ResolvedODR;
+  std::vector<std::pair<uint64_t, uint8_t>> DefinedLinkage;
+
+  bool operator==(const ThinLTOModuleRecord &Other) const {
+    return Hash == Other.Hash &&
+           Imports == Other.Imports &&
+           Exports == Other.Exports &&
+           ResolvedODR == Other.ResolvedODR &&
+           DefinedLinkage == Other.DefinedLinkage;
+  }
+};
+
+static ThinLTOModuleRecord
+getModuleRecord(const LLVMRustThinLTOData *Data, StringRef ModuleId) {
+  ThinLTOModuleRecord Record;
+  Record.Hash = Data->ModuleHashes.lookup(ModuleId);
+
+  // The import list is a `StringMap`, so sort the source modules to get a
+  // deterministic record. The functions imported from each module are already
+  // kept sorted.
+  auto ImportList = Data->ImportLists.find(ModuleId);
+  if (ImportList != Data->ImportLists.end()) {
+    for (auto &Entry : ImportList->second) {
+      std::vector<uint64_t> Functions;
+      for (auto &Function : Entry.second)
+        Functions.push_back(Function.first);
+      Record.Imports.emplace_back(Entry.first().str(),
+                                  Data->ModuleHashes.lookup(Entry.first()),
+                                  std::move(Functions));
+    }
+    std::sort(Record.Imports.begin(), Record.Imports.end());
+  }
+
+  auto ExportList = Data->ExportLists.find(ModuleId);
+  if (ExportList != Data->ExportLists.end()) {
+    Record.Exports.assign(ExportList->second.begin(), ExportList->second.end());
+    std::sort(Record.Exports.begin(), Record.Exports.end());
+  }
+
+  auto ResolvedODR = Data->ResolvedODR.find(ModuleId);
+  if (ResolvedODR != Data->ResolvedODR.end()) {
+    for (auto &Entry : ResolvedODR->second)
+      Record.ResolvedODR.emplace_back(Entry.first, Entry.second);
+  }
+
+  // Internalization and promotion are recorded in the linkage of the
+  // summaries for this module's definitions.
+  auto DefinedGlobals = Data->ModuleToDefinedGVSummaries.find(ModuleId);
+  if (DefinedGlobals != Data->ModuleToDefinedGVSummaries.end()) {
+    for (auto &Entry : DefinedGlobals->second)
+      Record.DefinedLinkage.emplace_back(Entry.first, Entry.second->linkage());
+  }
+  return Record;
+}
+
+// A minimal little-endian encoding for the analysis file and cache keys.
+static void writeU32(raw_ostream &OS, uint32_t I) {
+  support::endian::Writer<support::little>(OS).write(I);
+}
+
+static void writeU64(raw_ostream &OS, uint64_t I) {
+  support::endian::Writer<support::little>(OS).write(I);
+}
+
+static void writeString(raw_ostream &OS, StringRef S) {
+  writeU32(OS, S.size());
+  OS << S;
+}
+
+static void writeModuleRecord(raw_ostream &OS, const ThinLTOModuleRecord &R) {
+  writeString(OS, R.Hash);
+  writeU32(OS, R.Imports.size());
+  for (auto &Import : R.Imports) {
+    writeString(OS, std::get<0>(Import));
+    writeString(OS, std::get<1>(Import));
+    writeU32(OS, std::get<2>(Import).size());
+    for (auto GUID : std::get<2>(Import))
+      writeU64(OS, GUID);
+  }
+  writeU32(OS, R.Exports.size());
+  for (auto GUID : R.Exports)
+    writeU64(OS, GUID);
+  for (auto *Linkages : {&R.ResolvedODR, &R.DefinedLinkage}) {
+    writeU32(OS, Linkages->size());
+    for (auto &Entry : *Linkages) {
+      writeU64(OS, Entry.first);
+      OS << (char)Entry.second;
+    }
+  }
+}
+
+// Reads back what the functions above write, remembering whether it ever ran
+// off the end of the input.
+class AnalysisReader {
+  StringRef Data;
+  bool Failed = false;
+
+  StringRef take(size_t Len) {
+    if (Failed || Data.size() < Len) {
+      Failed = true;
+      return StringRef();
+    }
+    StringRef Ret = Data.substr(0, Len);
+    Data = Data.substr(Len);
+    return Ret;
+  }
+
+public:
+  explicit AnalysisReader(StringRef Data) : Data(Data) {}
+
+  bool failed() const { return Failed; }
+  bool atEnd() const { return Data.empty(); }
+
+  uint8_t readU8() {
+    StringRef S = take(1);
+    return Failed ? 0 : S[0];
+  }
+
+  uint32_t readU32() {
+    StringRef S = take(4);
+    return Failed ? 0 : support::endian::read32le(S.data());
+  }
+
+  uint64_t readU64() {
+    StringRef S = take(8);
+    return Failed ? 0 : support::endian::read64le(S.data());
+  }
+
+  std::string readString() {
+    uint32_t Len = readU32();
+    return take(Len).str();
+  }
+
+  ThinLTOModuleRecord readModuleRecord() {
+    ThinLTOModuleRecord R;
+    R.Hash = readString();
+    for (uint32_t I = 0, E = readU32(); I < E && !Failed; I++) {
+      std::string Source = readString();
+      std::string Hash = readString();
+      std::vector<uint64_t> Functions;
+      for (uint32_t J = 0, F = readU32(); J < F && !Failed; J++)
+        Functions.push_back(readU64());
+      R.Imports.emplace_back(std::move(Source), std::move(Hash),
+                             std::move(Functions));
+    }
+    for (uint32_t I = 0, E = readU32(); I < E && !Failed; I++)
+      R.Exports.push_back(readU64());
+    for (auto *Linkages : {&R.ResolvedODR, &R.DefinedLinkage}) {
+      for (uint32_t I = 0, E = readU32(); I < E && !Failed; I++) {
+        uint64_t GUID = readU64();
+        Linkages->emplace_back(GUID, readU8());
+      }
+    }
+    return R;
+  }
+};
+
+// Computes a key for the object file that the module `ModuleId` will turn into
+// once the per-module ThinLTO passes below and optimization have run. The key
+// is written out as a hex string to `KeyOut`.
+//
+// This is modeled after `ModuleCacheEntry` in
+// `lib/LTO/ThinLTOCodeGenerator.cpp`: the key covers the module's own
+// contents, everything it imports (and the contents of the modules it imports
+// from), everything it exports, and the linkage that weak symbols and the
+// module's definitions were resolved to. rustc mixes in its own version and
+// codegen options on top of this.
+extern "C" bool
+LLVMRustThinLTOGetCacheKey(const LLVMRustThinLTOData *Data,
+                           const char *ModuleId,
+                           RustStringRef KeyOut) {
+  if (!Data->ModuleHashes.count(ModuleId)) {
+    LLVMRustSetLastError("module not hashed for the ThinLTO cache");
+    return false;
+  }
+
+  std::string Record;
+  {
+    raw_string_ostream OS(Record);
+    writeString(OS, LLVM_VERSION_STRING);
+    writeModuleRecord(OS, getModuleRecord(Data, ModuleId));
+  }
+  SHA1 Hasher;
+  Hasher.update(Record);
+
+  RawRustStringOstream OS(KeyOut);
+  OS << toHex(Hasher.result());
+  return true;
+}
+
+// The ThinLTO analysis of a previous compilation, as read back from disk by
+// `LLVMRustThinLTOReadAnalysis`.
+struct LLVMRustThinLTOAnalysis {
+  std::map<std::string, ThinLTOModuleRecord> Modules;
+  std::vector<uint64_t> PreservedSymbols;
+};
+
+static const char ThinLTOAnalysisMagic[] = "RUSTTLTO";
+static const uint32_t ThinLTOAnalysisVersion = 1;
+
+// Writes the per-module results of the global ThinLTO analysis to `Path`, in
+// a compact binary format. `Tag` is an arbitrary string which must match when
+// the file is read back, used by rustc to tell apart analyses produced with
+// different compilers or options.
+extern "C" bool
+LLVMRustThinLTOWriteAnalysis(LLVMRustThinLTOData *Data,
+                             const char *Path,
+                             const char *Tag) {
+  LLVMRustThinLTOHashModules(Data);
+
+  // The file at `Path` may be hard linked from the previous incremental
+  // session, which must keep its own analysis, so never write to it in place.
+  // The analysis is written to a new file which then replaces it.
+  int FD;
+  SmallString<128> TmpPath;
+  std::error_code EC =
+      sys::fs::createUniqueFile(Twine(Path) + ".%%%%%%%%.tmp", FD, TmpPath);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return false;
+  }
+  raw_fd_ostream OS(FD, /* shouldClose */ true);
+  OS << ThinLTOAnalysisMagic;
+  writeU32(OS, ThinLTOAnalysisVersion);
+  writeString(OS, Tag);
+
+  std::vector<uint64_t> Preserved(Data->GUIDPreservedSymbols.begin(),
+                                  Data->GUIDPreservedSymbols.end());
+  std::sort(Preserved.begin(), Preserved.end());
+  writeU32(OS, Preserved.size());
+  for (auto GUID : Preserved)
+    writeU64(OS, GUID);
+
+  std::vector<StringRef> ModuleIds;
+  for (auto &Entry : Data->ModuleMap)
+    ModuleIds.push_back(Entry.first());
+  std::sort(ModuleIds.begin(), ModuleIds.end());
+  writeU32(OS, ModuleIds.size());
+  for (auto &ModuleId : ModuleIds) {
+    writeString(OS, ModuleId);
+    writeModuleRecord(OS, getModuleRecord(Data, ModuleId));
+  }
+
+  OS.close();
+  if (OS.has_error()) {
+    LLVMRustSetLastError("failed to write ThinLTO analysis");
+    OS.clear_error();
+    sys::fs::remove(TmpPath);
+    return false;
+  }
+  EC = sys::fs::rename(TmpPath, Path);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    sys::fs::remove(TmpPath);
+    return false;
+  }
+  return true;
+}
+
+extern "C" LLVMRustThinLTOAnalysis*
+LLVMRustThinLTOReadAnalysis(const char *Path, const char *Tag) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr = MemoryBuffer::getFile(Path);
+  if (!BufOrErr) {
+    LLVMRustSetLastError(BufOrErr.getError().message().c_str());
+    return nullptr;
+  }
+  StringRef Buffer = (*BufOrErr)->getBuffer();
+  StringRef Magic(ThinLTOAnalysisMagic);
+  if (!Buffer.startswith(Magic)) {
+    LLVMRustSetLastError("not a ThinLTO analysis file");
+    return nullptr;
+  }
+
+  AnalysisReader Reader(Buffer.substr(Magic.size()));
+  if (Reader.readU32() != ThinLTOAnalysisVersion || Reader.readString() != Tag) {
+    LLVMRustSetLastError("ThinLTO analysis was produced by a different compiler "
+                         "or with different options");
+    return nullptr;
+  }
+
+  auto Ret = llvm::make_unique<LLVMRustThinLTOAnalysis>();
+  for (uint32_t I = 0, E = Reader.readU32(); I < E && !Reader.failed(); I++)
+    Ret->PreservedSymbols.push_back(Reader.readU64());
+  for (uint32_t I = 0, E = Reader.readU32(); I < E && !Reader.failed(); I++) {
+    std::string ModuleId = Reader.readString();
+    Ret->Modules[ModuleId] = Reader.readModuleRecord();
+  }
+  if (Reader.failed() || !Reader.atEnd()) {
+    LLVMRustSetLastError("malformed ThinLTO analysis file");
+    return nullptr;
+  }
+  return Ret.release();
+}
+
+extern "C" void
+LLVMRustThinLTOFreeAnalysis(LLVMRustThinLTOAnalysis *Analysis) {
+  delete Analysis;
+}
+
+// Returns whether the module `ModuleId` would come out of the per-module
+// ThinLTO steps exactly as it did in the compilation that `Previous` was
+// written by: its contents, the contents of everything it imports, and the
+// results of the global analysis for it are all the same. Modules must have
+// been hashed with `LLVMRustThinLTOHashModules` first.
+extern "C" bool
+LLVMRustThinLTOModuleUnchanged(const LLVMRustThinLTOData *Data,
+                               const LLVMRustThinLTOAnalysis *Previous,
+                               const char *ModuleId) {
+  auto PreviousRecord = Previous->Modules.find(ModuleId);
+  if (PreviousRecord == Previous->Modules.end())
+    return false;
+  return PreviousRecord->second == getModuleRecord(Data, ModuleId);
+}
+
+// Writes out what's needed to run the ThinLTO backend for `ModuleId` in some
+// other process, like LLVM's `-thinlto-index-only` mode does: an index shard
+// with the summaries of the module itself and of everything it imports, and a
+// list of the modules it imports from, one per line.
+//
+// A backend finds the modules to import from by the module paths recorded in
+// the index, so every module identifier is replaced by the path its bitcode
+// was written to, as given by `ModuleIds` and `ModulePaths`. Both the shard
+// and the imports list only ever mention those paths.
+//
+// This is copied from `crossModuleImport` and `emitImports` in
+// `lib/LTO/ThinLTOCodeGenerator.cpp`.
+extern "C" bool
+LLVMRustThinLTOWriteIndexShard(const LLVMRustThinLTOData *Data,
+                               const char *ModuleId,
+                               const char **ModuleIds,
+                               const char **ModulePaths,
+                               size_t NumModules,
+                               const char *IndexPath,
+                               const char *ImportsPath) {
+  StringMap<std::string> PathForModule;
+  for (size_t i = 0; i < NumModules; i++)
+    PathForModule[ModuleIds[i]] = ModulePaths[i];
+  auto pathFor = [&](StringRef Id) -> StringRef {
+    auto It = PathForModule.find(Id);
+    if (It == PathForModule.end())
+      return Id;
+    return It->second;
+  };
+
+  const auto &ImportList = Data->ImportLists.lookup(ModuleId);
+  std::map<std::string, GVSummaryMapTy> ModuleToSummariesForIndex;
+  gatherImportedSummariesForModule(ModuleId,
+                                   Data->ModuleToDefinedGVSummaries,
+                                   ImportList,
+                                   ModuleToSummariesForIndex);
+
+  // Build a fresh index holding copies of just the summaries this module
+  // needs, with their module paths renamed. Aliases are patched up afterwards
+  // to point at the copy of their aliasee.
+  ModuleSummaryIndex ShardIndex;
+  DenseMap<const GlobalValueSummary *, GlobalValueSummary *> Copies;
+  std::vector<AliasSummary *> Aliases;
+  for (auto &Entry : ModuleToSummariesForIndex) {
+    StringRef OldPath = Entry.first;
+    auto *Record = ShardIndex.addModulePath(pathFor(OldPath),
+                                            Data->Index.getModuleId(OldPath),
+                                            Data->Index.getModuleHash(OldPath));
+    StringRef NewPath = Record->first();
+    for (auto &GVEntry : Entry.second) {
+      const GlobalValueSummary *Summary = GVEntry.second;
+      std::unique_ptr<GlobalValueSummary> Copy;
+      if (auto *FS = dyn_cast<FunctionSummary>(Summary)) {
+        Copy = llvm::make_unique<FunctionSummary>(*FS);
+      } else if (auto *VS = dyn_cast<GlobalVarSummary>(Summary)) {
+        Copy = llvm::make_unique<GlobalVarSummary>(*VS);
+      } else {
+        auto AS = llvm::make_unique<AliasSummary>(*cast<AliasSummary>(Summary));
+        Aliases.push_back(AS.get());
+        Copy = std::move(AS);
+      }
+      Copy->setModulePath(NewPath);
+      Copies[Summary] = Copy.get();
+      ShardIndex.addGlobalValueSummary(GVEntry.first, std::move(Copy));
+    }
+  }
+  for (auto *Alias : Aliases) {
+    auto It = Copies.find(&Alias->getAliasee());
+    if (It == Copies.end()) {
+      LLVMRustSetLastError("aliasee missing from the ThinLTO index shard");
+      return false;
+    }
+    Alias->setAliasee(*It->second);
+  }
+
+  std::error_code EC;
+  {
+    raw_fd_ostream OS(IndexPath, EC, sys::fs::F_None);
+    if (EC) {
+      LLVMRustSetLastError(EC.message().c_str());
+      return false;
+    }
+    WriteIndexToFile(ShardIndex, OS);
+  }
+
+  raw_fd_ostream OS(ImportsPath, EC, sys::fs::F_None);
+  if (EC) {
+    LLVMRustSetLastError(EC.message().c_str());
+    return false;
+  }
+  std::vector<StringRef> Sources;
+  for (auto &Entry : ImportList)
+    Sources.push_back(pathFor(Entry.first()));
+  std::sort(Sources.begin(), Sources.end());
+  for (auto &Source : Sources)
+    OS << Source << "\n";
+  return true;
+}
+
+// Loads an index shard written by `LLVMRustThinLTOWriteIndexShard` for the
+// module whose bitcode is at `ModulePath`, so the per-module steps below can
+// run for it in a process that never saw the other modules. The shard only
+// holds the summaries of the module itself and of what it imports, so
+// everything from another module in there is to be imported.
+//
+// This is what `runThinLTOBackend` in clang's `lib/CodeGen/BackendUtil.cpp`
+// does for `-fthinlto-index=`.
+extern "C" LLVMRustThinLTOData*
+LLVMRustThinLTOLoadIndexShard(const char *IndexPath, const char *ModulePath) {
+  auto Ret = llvm::make_unique<LLVMRustThinLTOData>();
+  Expected<std::unique_ptr<ModuleSummaryIndex>> ShardOrErr =
+    getModuleSummaryIndexForFile(IndexPath);
+  if (!ShardOrErr) {
+    LLVMRustSetLastError(toString(ShardOrErr.takeError()).c_str());
+    return nullptr;
+  }
+  ModuleSummaryIndex &Shard = **ShardOrErr;
+
+  // Move all summaries over, pointing them at our own copy of their module
+  // path as the shard's goes away at the end of this function.
+  StringMap<StringRef> Paths;
+  for (auto &Entry : Shard.modulePaths()) {
+    auto *Record = Ret->Index.addModulePath(Entry.first(),
+                                            Entry.second.first,
+                                            Entry.second.second);
+    Paths[Entry.first()] = Record->first();
+  }
+  for (auto &Entry : Shard) {
+    for (auto &Summary : Entry.second) {
+      Summary->setModulePath(Paths.lookup(Summary->modulePath()));
+      Ret->Index.addGlobalValueSummary(Entry.first, std::move(Summary));
+    }
+  }
+  Ret->Index.collectDefinedGVSummariesPerModule(Ret->ModuleToDefinedGVSummaries);
+
+  auto &ImportList = Ret->ImportLists[ModulePath];
+  for (auto &Entry : Ret->ModuleToDefinedGVSummaries) {
+    if (Entry.first() == ModulePath)
+      continue;
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+      MemoryBuffer::getFile(Entry.first());
+    if (!BufOrErr) {
+      std::string Error = "failed to read " + Entry.first().str() + ": " +
+                          BufOrErr.getError().message();
+      LLVMRustSetLastError(Error.c_str());
+      return nullptr;
+    }
+    Ret->ModuleMap[Entry.first()] = (*BufOrErr)->getMemBufferRef();
+    Ret->ShardInputs.push_back(std::move(*BufOrErr));
+
+    // The value doesn't matter, the entry is what gets it imported.
+    for (auto &GV : Entry.second)
+      ImportList[Entry.first()][GV.first] = 1;
+  }
+  return Ret.release();
+}
+
 // Below are the various passes that happen *per module* when doing ThinLTO.
 //
 // In other words, these are the functions that are all run concurrently
@@ -1047,10 +2832,17 @@ extern "C" bool
 LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
   Module &Mod = *unwrap(M);
   const auto &ImportList = Data->ImportLists.lookup(Mod.getModuleIdentifier());
-  auto Loader = [&](StringRef Identifier) {
-    const auto &Memory = Data->ModuleMap.lookup(Identifier);
+  auto Loader = [&](StringRef Identifier) -> Expected<std::unique_ptr<Module>> {
     auto &Context = Mod.getContext();
-    return getLazyBitcodeModule(Memory, Context, true, true);
+    auto BM = Data->BitcodeModules.find(Identifier);
+    if (BM == Data->BitcodeModules.end()) {
+      const auto &Memory = Data->ModuleMap.lookup(Identifier);
+      return getLazyBitcodeModule(Memory, Context, true, true);
+    }
+    // Work on a copy, as this data is shared with every other thread
+    // importing from the same module right now.
+    BitcodeModule Source = *BM->second;
+    return Source.getLazyModule(Context, true, true);
   };
   FunctionImporter Importer(Data->Index, Loader);
   Expected<bool> Result = Importer.importFunctions(Mod, ImportList);
@@ -1070,14 +2862,15 @@ LLVMRustPrepareThinLTOImport(const LLVMRustThinLTOData *Data, LLVMModuleRef M) {
 // This structure is basically an owned version of a serialize module, with
 // a ThinLTO summary attached.
 struct LLVMRustThinLTOBuffer {
-  std::string data;
+  SmallVector<char, 0> data;
 };
 
 extern "C" LLVMRustThinLTOBuffer*
 LLVMRustThinLTOBufferCreate(LLVMModuleRef M) {
   auto Ret = llvm::make_unique<LLVMRustThinLTOBuffer>();
+  Ret->data.reserve(estimateBitcodeSize(*unwrap(M)));
   {
-    raw_string_ostream OS(Ret->data);
+    raw_svector_ostream OS(Ret->data);
     {
       legacy::PassManager PM;
       PM.add(createWriteThinLTOBitcodePass(OS));
@@ -1099,7 +2892,7 @@ LLVMRustThinLTOBufferPtr(const LLVMRustThinLTOBuffer *Buffer) {
 
 extern "C" size_t
 LLVMRustThinLTOBufferLen(const LLVMRustThinLTOBuffer *Buffer) {
-  return Buffer->data.length();
+  return Buffer->data.size();
 }
 
 // This is what we used to parse upstream bitcode for actual ThinLTO
@@ -1140,8 +2933,9 @@ struct LLVMRustThinLTOModule {
 extern "C" LLVMRustThinLTOData*
 LLVMRustCreateThinLTOData(LLVMRustThinLTOModule *modules,
                           int num_modules,
-                          const char **preserved_symbols,
-                          int num_symbols) {
+                          const LLVMRustExportSet *Exports,
+                          bool preserve_roots_only,
+                          unsigned max_threads) {
   llvm_unreachable("ThinLTO not available");
 }
 
@@ -1170,6 +2964,80 @@ LLVMRustFreeThinLTOData(LLVMRustThinLTOData *Data) {
   llvm_unreachable("ThinLTO not available");
 }
 
+struct LLVMRustThinLTODataStats {
+};
+
+extern "C" void
+LLVMRustThinLTOGetDataStats(const LLVMRustThinLTOData *Data,
+                            LLVMRustThinLTODataStats *Stats) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+struct LLVMRustThinLTOModuleStats {
+};
+
+extern "C" void
+LLVMRustThinLTOGetModuleStats(const LLVMRustThinLTOData *Data,
+                              const char *ModuleId,
+                              LLVMRustThinLTOModuleStats *Stats) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" void
+LLVMRustThinLTOHashModules(LLVMRustThinLTOData *Data) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" bool
+LLVMRustThinLTOGetCacheKey(const LLVMRustThinLTOData *Data,
+                           const char *ModuleId,
+                           RustStringRef KeyOut) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+struct LLVMRustThinLTOAnalysis {
+};
+
+extern "C" bool
+LLVMRustThinLTOWriteIndexShard(const LLVMRustThinLTOData *Data,
+                               const char *ModuleId,
+                               const char **ModuleIds,
+                               const char **ModulePaths,
+                               size_t NumModules,
+                               const char *IndexPath,
+                               const char *ImportsPath) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" LLVMRustThinLTOData*
+LLVMRustThinLTOLoadIndexShard(const char *IndexPath, const char *ModulePath) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" bool
+LLVMRustThinLTOWriteAnalysis(LLVMRustThinLTOData *Data,
+                             const char *Path,
+                             const char *Tag) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" LLVMRustThinLTOAnalysis*
+LLVMRustThinLTOReadAnalysis(const char *Path, const char *Tag) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" void
+LLVMRustThinLTOFreeAnalysis(LLVMRustThinLTOAnalysis *Analysis) {
+  llvm_unreachable("ThinLTO not available");
+}
+
+extern "C" bool
+LLVMRustThinLTOModuleUnchanged(const LLVMRustThinLTOData *Data,
+                               const LLVMRustThinLTOAnalysis *Previous,
+                               const char *ModuleId) {
+  llvm_unreachable("ThinLTO not available");
+}
+
 struct LLVMRustThinLTOBuffer {
 };
 
@@ -9,10 +9,13 @@
 // except according to those terms.
 
 #include "rustllvm.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
@@ -160,6 +163,8 @@ static Attribute::AttrKind fromRust(LLVMRustAttribute Kind) {
     return Attribute::SanitizeAddress;
   case SanitizeMemory:
     return Attribute::SanitizeMemory;
+  case Dereferenceable:
+    return Attribute::Dereferenceable;
   }
   llvm_unreachable("bad AttributeKind");
 }
@@ -248,6 +253,61 @@ extern "C" void LLVMRustRemoveFunctionAttributes(LLVMValueRef Fn,
   F->setAttributes(PALNew);
 }
 
+struct LLVMRustAttributeEntry {
+  unsigned Index;
+  LLVMRustAttribute Kind;
+  uint64_t Value;
+};
+
+#if LLVM_VERSION_GE(5, 0)
+typedef AttributeList LLVMRustAttributeList;
+#else
+typedef AttributeSet LLVMRustAttributeList;
+#endif
+
+// Adds all of `Entries` to `Attrs` at once. Entries for the same index are
+// expected to be next to each other, and are collected into one builder, so
+// the attribute list is rebuilt once per index rather than per attribute.
+static LLVMRustAttributeList
+addAttributes(LLVMContext &C, LLVMRustAttributeList Attrs,
+              const LLVMRustAttributeEntry *Entries, size_t NumEntries) {
+  size_t I = 0;
+  while (I < NumEntries) {
+    unsigned Index = Entries[I].Index;
+    AttrBuilder B;
+    for (; I < NumEntries && Entries[I].Index == Index; I++) {
+      if (Entries[I].Kind == Dereferenceable)
+        B.addDereferenceableAttr(Entries[I].Value);
+      else
+        B.addAttribute(fromRust(Entries[I].Kind));
+    }
+#if LLVM_VERSION_GE(5, 0)
+    Attrs = Attrs.addAttributes(C, Index, B);
+#else
+    Attrs = Attrs.addAttributes(C, Index, AttributeSet::get(C, Index, B));
+#endif
+  }
+  return Attrs;
+}
+
+extern "C" void
+LLVMRustAddFunctionAttributes(LLVMValueRef Fn,
+                              const LLVMRustAttributeEntry *Entries,
+                              size_t NumEntries) {
+  Function *F = unwrap<Function>(Fn);
+  F->setAttributes(
+      addAttributes(F->getContext(), F->getAttributes(), Entries, NumEntries));
+}
+
+extern "C" void
+LLVMRustAddCallSiteAttributes(LLVMValueRef Instr,
+                              const LLVMRustAttributeEntry *Entries,
+                              size_t NumEntries) {
+  CallSite Call = CallSite(unwrap<Instruction>(Instr));
+  Call.setAttributes(addAttributes(Call->getContext(), Call.getAttributes(),
+                                   Entries, NumEntries));
+}
+
 // enable fpmath flag UnsafeAlgebra
 extern "C" void LLVMRustSetHasUnsafeAlgebra(LLVMValueRef V) {
   if (auto I = dyn_cast<Instruction>(unwrap<Value>(V))) {
@@ -849,49 +909,85 @@ extern "C" void LLVMRustWriteValueToString(LLVMValueRef V,
   }
 }
 
-extern "C" bool LLVMRustLinkInExternalBitcode(LLVMModuleRef DstRef, char *BC,
-                                              size_t Len) {
-  Module *Dst = unwrap(DstRef);
-
-  std::unique_ptr<MemoryBuffer> Buf =
-      MemoryBuffer::getMemBufferCopy(StringRef(BC, Len));
-
+// Lazily parses the bitcode in `BC` into `Ctx` without copying it first. The
+// returned module borrows `BC` until it's fully materialized, so callers must
+// link (or destroy) it before the bitcode goes away.
+static std::unique_ptr<Module> parseBorrowedBitcode(LLVMContext &Ctx,
+                                                    const char *BC, size_t Len,
+                                                    const char *Identifier) {
+  MemoryBufferRef Ref(StringRef(BC, Len), Identifier ? Identifier : "");
 #if LLVM_VERSION_GE(4, 0)
   Expected<std::unique_ptr<Module>> SrcOrError =
-      llvm::getLazyBitcodeModule(Buf->getMemBufferRef(), Dst->getContext());
+      llvm::getLazyBitcodeModule(Ref, Ctx);
   if (!SrcOrError) {
     LLVMRustSetLastError(toString(SrcOrError.takeError()).c_str());
-    return false;
+    return nullptr;
   }
-
-  auto Src = std::move(*SrcOrError);
+  return std::move(*SrcOrError);
 #else
+  std::unique_ptr<MemoryBuffer> Buf =
+      MemoryBuffer::getMemBuffer(Ref, /* RequiresNullTerminator = */ false);
   ErrorOr<std::unique_ptr<Module>> Src =
-      llvm::getLazyBitcodeModule(std::move(Buf), Dst->getContext());
+      llvm::getLazyBitcodeModule(std::move(Buf), Ctx);
   if (!Src) {
     LLVMRustSetLastError(Src.getError().message().c_str());
-    return false;
+    return nullptr;
   }
+  return std::move(*Src);
+#endif
+}
+
+// Links `Num` bitcode modules into `Dst` with a single `Linker`, so the
+// destination's symbol tables and type mapping are only built once for the
+// whole batch.
+//
+// The bitcode is borrowed rather than copied: each `BCs[i]` only has to stay
+// valid for the duration of this call, as every source module is fully
+// materialized and destroyed by the linker before the next one is parsed.
+// `Identifiers` may be null, otherwise `Identifiers[i]` names the module in
+// diagnostics.
+extern "C" bool LLVMRustLinkInExternalBitcodes(LLVMModuleRef DstRef,
+                                               const char *const *BCs,
+                                               const size_t *Lens,
+                                               const char *const *Identifiers,
+                                               size_t Num) {
+  Module *Dst = unwrap(DstRef);
+#if LLVM_VERSION_GE(3, 8)
+  Linker L(*Dst);
 #endif
 
-  std::string Err;
+  for (size_t I = 0; I < Num; I++) {
+    const char *Identifier = Identifiers ? Identifiers[I] : nullptr;
+    std::unique_ptr<Module> Src =
+        parseBorrowedBitcode(Dst->getContext(), BCs[I], Lens[I], Identifier);
+    if (!Src)
+      return false;
 
-  raw_string_ostream Stream(Err);
-  DiagnosticPrinterRawOStream DP(Stream);
-#if LLVM_VERSION_GE(4, 0)
-  if (Linker::linkModules(*Dst, std::move(Src))) {
-#elif LLVM_VERSION_GE(3, 8)
-  if (Linker::linkModules(*Dst, std::move(Src.get()))) {
+    std::string Err;
+    raw_string_ostream Stream(Err);
+    DiagnosticPrinterRawOStream DP(Stream);
+#if LLVM_VERSION_GE(3, 8)
+    if (L.linkInModule(std::move(Src))) {
 #else
-  if (Linker::LinkModules(Dst, Src->get(),
-                          [&](const DiagnosticInfo &DI) { DI.print(DP); })) {
+    if (Linker::LinkModules(Dst, Src.get(),
+                            [&](const DiagnosticInfo &DI) { DI.print(DP); })) {
 #endif
-    LLVMRustSetLastError(Err.c_str());
-    return false;
+      Stream.flush();
+      if (Err.empty() && Identifier)
+        Err = std::string("failed to link ") + Identifier;
+      LLVMRustSetLastError(Err.c_str());
+      return false;
+    }
   }
   return true;
 }
 
+extern "C" bool LLVMRustLinkInExternalBitcode(LLVMModuleRef DstRef, char *BC,
+                                              size_t Len) {
+  const char *BCs[] = {BC};
+  return LLVMRustLinkInExternalBitcodes(DstRef, BCs, &Len, nullptr, 1);
+}
+
 extern "C" bool LLVMRustLinkInParsedExternalBitcode(
     LLVMModuleRef DstRef, LLVMModuleRef SrcRef) {
 #if LLVM_VERSION_GE(4, 0)
@@ -1222,6 +1318,22 @@ extern "C" LLVMValueRef LLVMRustBuildCall(LLVMBuilderRef B, LLVMValueRef Fn,
       unwrap(Fn), makeArrayRef(unwrap(Args), NumArgs), Bundles, Name));
 }
 
+// Builds a call which already has all of its attributes and its calling
+// convention, instead of having them added one after another.
+extern "C" LLVMValueRef LLVMRustBuildCallWithAttributes(
+    LLVMBuilderRef B, LLVMValueRef Fn, LLVMValueRef *Args, unsigned NumArgs,
+    OperandBundleDef *Bundle, const LLVMRustAttributeEntry *Entries,
+    size_t NumEntries, unsigned CallConv, const char *Name) {
+  unsigned Len = Bundle ? 1 : 0;
+  ArrayRef<OperandBundleDef> Bundles = makeArrayRef(Bundle, Len);
+  CallInst *Call = unwrap(B)->CreateCall(
+      unwrap(Fn), makeArrayRef(unwrap(Args), NumArgs), Bundles, Name);
+  Call->setAttributes(addAttributes(Call->getContext(), Call->getAttributes(),
+                                    Entries, NumEntries));
+  Call->setCallingConv(CallConv);
+  return wrap(Call);
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildInvoke(LLVMBuilderRef B, LLVMValueRef Fn, LLVMValueRef *Args,
                     unsigned NumArgs, LLVMBasicBlockRef Then,
@@ -1248,6 +1360,16 @@ extern "C" LLVMValueRef LLVMRustBuildCall(LLVMBuilderRef B, LLVMValueRef Fn,
   return LLVMBuildCall(B, Fn, Args, NumArgs, Name);
 }
 
+extern "C" LLVMValueRef LLVMRustBuildCallWithAttributes(
+    LLVMBuilderRef B, LLVMValueRef Fn, LLVMValueRef *Args, unsigned NumArgs,
+    void *Bundle, const LLVMRustAttributeEntry *Entries, size_t NumEntries,
+    unsigned CallConv, const char *Name) {
+  LLVMValueRef Call = LLVMBuildCall(B, Fn, Args, NumArgs, Name);
+  LLVMRustAddCallSiteAttributes(Call, Entries, NumEntries);
+  LLVMSetInstructionCallConv(Call, CallConv);
+  return Call;
+}
+
 extern "C" LLVMValueRef
 LLVMRustBuildInvoke(LLVMBuilderRef B, LLVMValueRef Fn, LLVMValueRef *Args,
                     unsigned NumArgs, LLVMBasicBlockRef Then,
@@ -1422,21 +1544,43 @@ extern "C" void LLVMRustSetVisibility(LLVMValueRef V,
   LLVMSetVisibility(V, fromRust(RustVisibility));
 }
 
+// A rough estimate of how large the serialized bitcode of a module will be,
+// used to size buffers for bitcode up front. This deliberately errs on the
+// large side: the untouched tail of a large allocation typically never gets
+// paged in, while growing a buffer means copying everything written so far.
+size_t estimateBitcodeSize(const Module &M) {
+  size_t Size = 64 * 1024;
+  for (const Function &F : M) {
+    Size += 128;
+    for (const BasicBlock &BB : F)
+      Size += 16 * BB.size();
+  }
+  Size += 64 * (M.global_size() + M.alias_size());
+  return Size;
+}
+
 struct LLVMRustModuleBuffer {
-  std::string data;
+  SmallVector<char, 0> data;
 };
 
 extern "C" LLVMRustModuleBuffer*
 LLVMRustModuleBufferCreate(LLVMModuleRef M) {
   auto Ret = llvm::make_unique<LLVMRustModuleBuffer>();
-  {
-    raw_string_ostream OS(Ret->data);
-    {
-      legacy::PassManager PM;
-      PM.add(createBitcodeWriterPass(OS));
-      PM.run(*unwrap(M));
-    }
-  }
+  Module &Mod = *unwrap(M);
+  Ret->data.reserve(estimateBitcodeSize(Mod));
+#if LLVM_VERSION_GE(4, 0)
+  // Serialize straight into our own buffer, rather than having the bitcode
+  // writer build everything in a temporary buffer and then copy it over.
+  BitcodeWriter Writer(Ret->data);
+  Writer.writeModule(&Mod);
+#if LLVM_VERSION_GE(5, 0)
+  Writer.writeSymtab();
+  Writer.writeStrtab();
+#endif
+#else
+  raw_svector_ostream OS(Ret->data);
+  WriteBitcodeToFile(&Mod, OS);
+#endif
   return Ret.release();
 }
 
@@ -1452,16 +1596,52 @@ LLVMRustModuleBufferPtr(const LLVMRustModuleBuffer *Buffer) {
 
 extern "C" size_t
 LLVMRustModuleBufferLen(const LLVMRustModuleBuffer *Buffer) {
-  return Buffer->data.length();
+  return Buffer->data.size();
 }
 
-extern "C" uint64_t
-LLVMRustModuleCost(LLVMModuleRef M) {
+struct LLVMRustModuleCostBreakdown {
+  uint64_t Functions;
+  uint64_t Instructions;
+  uint64_t BasicBlocks;
+  uint64_t CallSites;
+  uint64_t MaxLoopDepth;
+  uint64_t BitcodeSize;
+};
+
+// Gathers a rough breakdown of how much work optimizing and generating code for
+// this module is going to be. Only function definitions are counted, and calls
+// to intrinsics aren't considered call sites as they'll never be inlined.
+extern "C" void
+LLVMRustModuleCost(LLVMModuleRef M, LLVMRustModuleCostBreakdown *Cost) {
   Module &Mod = *unwrap(M);
-  uint64_t cost = 0;
-  for (auto &F : Mod.functions()) {
-    (void)F;
-    cost += 1;
+  *Cost = LLVMRustModuleCostBreakdown();
+  for (Function &F : Mod.functions()) {
+    if (F.isDeclaration())
+      continue;
+    Cost->Functions++;
+
+    // Loop depth is only interesting if there are any loops at all, so avoid
+    // building the dominator tree for functions that are a single block.
+    bool MayHaveLoops = F.size() > 1;
+    for (BasicBlock &BB : F) {
+      Cost->BasicBlocks++;
+      Cost->Instructions += BB.size();
+      for (Instruction &I : BB) {
+        CallSite CS(&I);
+        if (CS && !isa<IntrinsicInst>(I))
+          Cost->CallSites++;
+      }
+    }
+    if (MayHaveLoops) {
+      DominatorTree DT(F);
+      LoopInfo LI;
+      LI.analyze(DT);
+      for (BasicBlock &BB : F) {
+        uint64_t Depth = LI.getLoopDepth(&BB);
+        if (Depth > Cost->MaxLoopDepth)
+          Cost->MaxLoopDepth = Depth;
+      }
+    }
   }
-  return cost;
+  Cost->BitcodeSize = estimateBitcodeSize(Mod);
 }
@@ -77,6 +77,8 @@
 
 void LLVMRustSetLastError(const char *);
 
+size_t estimateBitcodeSize(const llvm::Module &M);
+
 enum class LLVMRustResult { Success, Failure };
 
 enum LLVMRustAttribute {
@@ -103,6 +105,7 @@ enum LLVMRustAttribute {
   SanitizeThread = 20,
   SanitizeAddress = 21,
   SanitizeMemory = 22,
+  Dereferenceable = 23,
 };
 
 typedef struct OpaqueRustString *RustStringRef;
@@ -0,0 +1,39 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+// min-llvm-version 4.0
+// compile-flags: -O -Z merge-functions
+
+#![crate_type = "lib"]
+
+// Identical functions with visible symbols keep them, but all except the one
+// with the smallest name become thunks.
+
+// CHECK-LABEL: define i32 @add_i32
+// CHECK: add i32
+#[no_mangle]
+pub fn add_i32(a: i32, b: i32) -> i32 {
+    a.wrapping_add(b)
+}
+
+// CHECK-LABEL: define i32 @add_u32
+// CHECK: tail call i32 @add_i32
+// CHECK-NEXT: ret i32
+#[no_mangle]
+pub fn add_u32(a: u32, b: u32) -> u32 {
+    a.wrapping_add(b)
+}
+
+// CHECK-LABEL: define i32 @sub_u32
+// CHECK: sub i32
+#[no_mangle]
+pub fn sub_u32(a: u32, b: u32) -> u32 {
+    a.wrapping_sub(b)
+}
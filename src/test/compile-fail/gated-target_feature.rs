@@ -13,3 +13,7 @@
 #[target_feature = "+sse2"]
 //~^ the `#[target_feature]` attribute is an experimental feature
 fn foo() {}
+
+#[target_clones = "+avx2"]
+//~^ the `#[target_clones]` attribute is an experimental feature
+fn bar() {}
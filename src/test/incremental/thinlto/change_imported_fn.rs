@@ -0,0 +1,48 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+// Change a function that ThinLTO imports into another codegen unit whose own
+// code doesn't change. That unit still has to be optimized again, linking
+// its object from the previous session would keep the old result.
+
+// revisions: rpass1 rpass2 rpass3
+// compile-flags: -O -Z thinlto -C codegen-units=4
+// min-llvm-version 4.0
+
+mod callee {
+    pub fn value() -> u32 {
+        #[cfg(rpass1)]
+        return 1;
+
+        #[cfg(rpass2)]
+        return 2;
+
+        #[cfg(rpass3)]
+        return 1;
+    }
+}
+
+mod caller {
+    #[inline(never)]
+    pub fn doubled() -> u32 {
+        ::callee::value() * 2
+    }
+}
+
+fn main() {
+    #[cfg(rpass1)]
+    assert_eq!(caller::doubled(), 2);
+
+    #[cfg(rpass2)]
+    assert_eq!(caller::doubled(), 4);
+
+    #[cfg(rpass3)]
+    assert_eq!(caller::doubled(), 2);
+}
@@ -0,0 +1,48 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+// With `-Z reuse-unchanged-ir-objects`, a codegen unit that has to be
+// translated again but comes out as the same LLVM IR reuses its object from
+// the previous session (rpass2). Once the IR does change, the object mustn't
+// be reused anymore (rpass3). The run-make test reuse-unchanged-ir-objects
+// checks that the object is actually reused.
+
+// revisions: rpass1 rpass2 rpass3
+// compile-flags: -Z query-dep-graph -Z reuse-unchanged-ir-objects
+
+#![feature(rustc_attrs)]
+#![feature(stmt_expr_attributes)]
+
+#![rustc_partition_translated(module="unchanged_ir_object_reuse-values", cfg="rpass2")]
+#![rustc_partition_translated(module="unchanged_ir_object_reuse-values", cfg="rpass3")]
+
+mod values {
+    pub fn seven() -> u32 {
+        // Spelling out the inferred type changes the HIR but not the IR.
+        #[cfg(rpass1)]
+        let x = 7;
+
+        #[cfg(rpass2)]
+        let x: u32 = 7;
+
+        #[cfg(rpass3)]
+        let x: u32 = 8;
+
+        x
+    }
+}
+
+fn main() {
+    #[cfg(any(rpass1, rpass2))]
+    assert_eq!(values::seven(), 7);
+
+    #[cfg(rpass3)]
+    assert_eq!(values::seven(), 8);
+}
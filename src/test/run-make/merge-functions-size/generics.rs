@@ -0,0 +1,71 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+// Lots of newtypes around the same integer, each run through the same set of
+// generic collection code. Every instantiation compiles to the same machine
+// code, which is the pattern function merging is meant to fold.
+
+#![crate_type = "lib"]
+
+use std::collections::{BTreeMap, HashMap, VecDeque};
+
+pub trait Key: Copy + Ord + std::hash::Hash {
+    fn new(x: u32) -> Self;
+    fn get(self) -> u32;
+}
+
+fn exercise<K: Key>(n: u32) -> u64 {
+    let mut v: Vec<K> = (0..n).map(|i| K::new(i.wrapping_mul(2654435761))).collect();
+    v.sort();
+    v.dedup();
+    let mut tree = BTreeMap::new();
+    let mut hash = HashMap::new();
+    let mut queue = VecDeque::new();
+    for (i, &k) in v.iter().enumerate() {
+        tree.insert(k, i);
+        hash.insert(k, i);
+        queue.push_back(k);
+    }
+    let mut sum = 0u64;
+    while let Some(k) = queue.pop_front() {
+        sum += tree[&k] as u64 + hash[&k] as u64 + k.get() as u64;
+        if v.binary_search(&k).is_err() {
+            sum += 1;
+        }
+    }
+    sum
+}
+
+macro_rules! keys {
+    ($($name:ident)*) => {
+        $(
+            #[derive(Copy, Clone, PartialEq, Eq, PartialOrd, Ord, Hash)]
+            pub struct $name(u32);
+
+            impl Key for $name {
+                fn new(x: u32) -> $name { $name(x) }
+                fn get(self) -> u32 { self.0 }
+            }
+        )*
+
+        pub fn run_all(n: u32) -> u64 {
+            let mut sum = 0;
+            $(sum += exercise::<$name>(n);)*
+            sum
+        }
+    }
+}
+
+keys! {
+    K00 K01 K02 K03 K04 K05 K06 K07 K08 K09 K10 K11 K12 K13 K14 K15
+    K16 K17 K18 K19 K20 K21 K22 K23 K24 K25 K26 K27 K28 K29 K30 K31
+    K32 K33 K34 K35 K36 K37 K38 K39 K40 K41 K42 K43 K44 K45 K46 K47
+    K48 K49 K50 K51 K52 K53 K54 K55 K56 K57 K58 K59 K60 K61 K62 K63
+}
@@ -0,0 +1,25 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+pub mod a {
+    pub fn double(x: u32) -> u32 {
+        x * 2
+    }
+}
+
+pub mod b {
+    pub fn quadruple(x: u32) -> u32 {
+        ::a::double(::a::double(x))
+    }
+}
+
+fn main() {
+    assert_eq!(::b::quadruple(3), 12);
+}
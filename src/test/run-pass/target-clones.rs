@@ -0,0 +1,51 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+// min-llvm-version 4.0
+// compile-flags: -O
+
+// Whichever clone the CPU ends up dispatching to has to behave the same as
+// the default. Targets without ifunc support only ever get the default.
+
+#![feature(target_feature)]
+
+#[target_clones = "+avx512f,+avx512bw;+avx2,+fma;+sse4.2"]
+#[inline(never)]
+pub fn sum(xs: &[u32]) -> u32 {
+    xs.iter().fold(0, |a, &b| a.wrapping_add(b))
+}
+
+#[target_clones = "+avx2"]
+#[inline(never)]
+fn fib(n: u64) -> u64 {
+    if n < 2 { n } else { fib(n - 1) + fib(n - 2) }
+}
+
+#[target_clones = "+avx2"]
+#[inline(never)]
+fn max<T: PartialOrd + Copy>(xs: &[T]) -> Option<T> {
+    xs.iter().cloned().fold(None, |m, x| match m {
+        Some(m) if m >= x => Some(m),
+        _ => Some(x),
+    })
+}
+
+fn main() {
+    let xs: Vec<u32> = (0..1000).collect();
+    assert_eq!(sum(&xs), 499500);
+    let f: fn(&[u32]) -> u32 = sum;
+    assert_eq!(f(&xs[..10]), 45);
+
+    assert_eq!(fib(20), 6765);
+
+    assert_eq!(max(&[3, 1, 4, 1, 5, 9, 2, 6]), Some(9));
+    assert_eq!(max(&[0.5f64, -1.0]), Some(0.5));
+    assert_eq!(max::<u8>(&[]), None);
+}
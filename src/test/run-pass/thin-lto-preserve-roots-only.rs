@@ -0,0 +1,45 @@
+// Copyright 2017 The Rust Project Developers. See the COPYRIGHT
+// file at the top-level directory of this distribution and at
+// http://rust-lang.org/COPYRIGHT.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+// compile-flags: -Z thinlto -Z thinlto-preserve-roots-only -C codegen-units=8 -O -C lto
+// min-llvm-version 4.0
+// no-prefer-dynamic
+// ignore-emscripten
+
+// When only the exported symbols are preserved by ThinLTO everything else is
+// fair game for internalization, except for what's referenced from other
+// modules. Make sure that calls across codegen units which can't be inlined
+// still link.
+
+mod a {
+    #[inline(never)]
+    pub fn big(n: u32) -> u32 {
+        let mut v = Vec::new();
+        for i in 0..n {
+            v.push(i.wrapping_mul(::b::small(i)));
+        }
+        v.iter().fold(0, |a, b| a ^ b)
+    }
+}
+
+mod b {
+    pub fn small(n: u32) -> u32 {
+        n + 1
+    }
+
+    #[inline(never)]
+    pub fn calls_big() -> u32 {
+        ::a::big(10)
+    }
+}
+
+fn main() {
+    assert_eq!(b::calls_big(), a::big(10));
+}
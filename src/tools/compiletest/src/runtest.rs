@@ -2101,6 +2101,14 @@ actual:\n\
            .env("LLVM_COMPONENTS", &self.config.llvm_components)
            .env("LLVM_CXXFLAGS", &self.config.llvm_cxxflags);
 
+        // Tools like `opt` live next to `FileCheck`, so let tests which need
+        // them find them there.
+        if let Some(ref filecheck) = self.config.llvm_filecheck {
+            if let Some(bin_dir) = filecheck.parent() {
+                cmd.env("LLVM_BIN_DIR", bin_dir);
+            }
+        }
+
         // We don't want RUSTFLAGS set from the outside to interfere with
         // compiler flags set in the test cases:
         cmd.env_remove("RUSTFLAGS");